@@ -0,0 +1,391 @@
+#ifndef ACCUMULATION_H
+#define ACCUMULATION_H
+
+// NOTE(ralntdir): The state of a progressive render. Every pixel keeps
+// the sums of its samples, how many samples it has and its own random
+// series, so pixels don't depend on each other or on the order (or the
+// thread) they are rendered in. Saving this state and loading it back
+// continues the render exactly where it was.
+struct accumulationBuffer
+{
+  int32 width;
+  int32 height;
+  uint64 seed;
+
+  // NOTE(ralntdir): Where the buffer is in the image. It's all of it,
+  // unless the buffer is a tile of an image that is rendered in tiles.
+  int32 originX;
+  int32 originY;
+  int32 imageWidth;
+  int32 imageHeight;
+
+  // NOTE(ralntdir): Per pixel sums. 3 channels for color, albedo and
+  // normal, 1 for depth, and the luminance and squared luminance for
+  // the noise estimate.
+  real32 *color;
+  real32 *albedo;
+  real32 *normal;
+  real32 *depth;
+  real32 *luminance;
+  real32 *luminanceSquared;
+
+  uint32 *samples;
+  randomSeries *series;
+};
+
+// NOTE(ralntdir): Number of real32 per pixel in the buffers above.
+#define ACCUMULATION_CHANNELS 12
+
+// NOTE(ralntdir): The pixels of a tile get the same random series they
+// get in a buffer for the whole image, so an image rendered in tiles is
+// the same image.
+accumulationBuffer allocateAccumulationTile(imageRegion tile, int32 imageWidth, int32 imageHeight, uint64 seed)
+{
+  accumulationBuffer result = {};
+  int32 width = tile.maxX - tile.minX;
+  int32 height = tile.maxY - tile.minY;
+  size_t count = pixelCount(width, height);
+
+  result.width = width;
+  result.height = height;
+  result.seed = seed;
+  result.originX = tile.minX;
+  result.originY = tile.minY;
+  result.imageWidth = imageWidth;
+  result.imageHeight = imageHeight;
+
+  result.color = new real32[ACCUMULATION_CHANNELS*count]();
+  result.albedo = result.color + 3*count;
+  result.normal = result.color + 6*count;
+  result.depth = result.color + 9*count;
+  result.luminance = result.color + 10*count;
+  result.luminanceSquared = result.color + 11*count;
+
+  result.samples = new uint32[count]();
+  result.series = new randomSeries[count];
+
+  for (int32 y = 0; y < height; y++)
+  {
+    for (int32 x = 0; x < width; x++)
+    {
+      uint64 pixel = (uint64)(tile.minY + y)*imageWidth + (tile.minX + x);
+      result.series[y*width + x] = seedSeries(seed*0x9E3779B97F4A7C15ull + pixel);
+    }
+  }
+
+  return(result);
+}
+
+accumulationBuffer allocateAccumulationBuffer(int32 width, int32 height, uint64 seed)
+{
+  accumulationBuffer result = allocateAccumulationTile(fullRegion(width, height), width, height, seed);
+
+  return(result);
+}
+
+// NOTE(ralntdir): Of pixel x, y of the image.
+inline size_t accumulationIndex(accumulationBuffer *accum, int32 x, int32 y)
+{
+  size_t result = (size_t)(y - accum->originY)*accum->width + (x - accum->originX);
+
+  return(result);
+}
+
+void freeAccumulationBuffer(accumulationBuffer *accum)
+{
+  delete[] accum->color;
+  delete[] accum->samples;
+  delete[] accum->series;
+  *accum = {};
+}
+
+void copyAccumulationBuffer(accumulationBuffer *dest, accumulationBuffer *source)
+{
+  size_t count = pixelCount(source->width, source->height);
+
+  memcpy(dest->color, source->color, ACCUMULATION_CHANNELS*count*sizeof(real32));
+  memcpy(dest->samples, source->samples, count*sizeof(uint32));
+  memcpy(dest->series, source->series, count*sizeof(randomSeries));
+}
+
+// NOTE(ralntdir): Drops what the pixels of the region have accumulated,
+// so they are rendered again from 0 samples. Their random series go on
+// where they were.
+void clearAccumulationRegion(accumulationBuffer *accum, imageRegion region)
+{
+  for (int32 y = region.minY; y < region.maxY; y++)
+  {
+    for (int32 x = region.minX; x < region.maxX; x++)
+    {
+      size_t i = accumulationIndex(accum, x, y);
+
+      for (int32 c = 0; c < 3; c++)
+      {
+        accum->color[3*i + c] = 0.0f;
+        accum->albedo[3*i + c] = 0.0f;
+        accum->normal[3*i + c] = 0.0f;
+      }
+      accum->depth[i] = 0.0f;
+      accum->luminance[i] = 0.0f;
+      accum->luminanceSquared[i] = 0.0f;
+      accum->samples[i] = 0;
+    }
+  }
+}
+
+// NOTE(ralntdir): Only the average color, into a framebuffer the size
+// of the buffer.
+void resolveAccumulationColor(accumulationBuffer *accum, framebuffer *fb)
+{
+  size_t count = pixelCount(accum->width, accum->height);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    uint32 n = accum->samples[i];
+    real32 invSamples = n ? 1.0f/n : 0.0f;
+
+    for (int32 c = 0; c < 3; c++)
+    {
+      fb->pixels[3*i + c] = accum->color[3*i + c]*invSamples;
+    }
+  }
+}
+
+// NOTE(ralntdir): Averages the sums into the framebuffer and the
+// buffers that guide the denoiser.
+void resolveAccumulationBuffer(accumulationBuffer *accum, framebuffer *fb, auxBuffers *aux)
+{
+  size_t count = pixelCount(accum->width, accum->height);
+
+  #pragma omp parallel for
+  for (size_t i = 0; i < count; i++)
+  {
+    uint32 n = accum->samples[i];
+    real32 invSamples = n ? 1.0f/n : 0.0f;
+
+    for (int32 c = 0; c < 3; c++)
+    {
+      fb->pixels[3*i + c] = accum->color[3*i + c]*invSamples;
+      aux->albedo.pixels[3*i + c] = accum->albedo[3*i + c]*invSamples;
+      aux->normal.pixels[3*i + c] = accum->normal[3*i + c]*invSamples;
+      aux->depth.pixels[3*i + c] = accum->depth[i]*invSamples;
+    }
+
+    // NOTE(ralntdir): Variance of the mean, that is, the noise that is
+    // left in the pixel. One sample can't tell, so it says converged.
+    real32 variance = 0.0f;
+    if (n > 1)
+    {
+      real32 mean = accum->luminance[i]*invSamples;
+      variance = max(accum->luminanceSquared[i] - n*mean*mean, 0.0);
+      variance /= real32(n - 1)*n;
+    }
+
+    for (int32 c = 0; c < 3; c++)
+    {
+      aux->variance.pixels[3*i + c] = variance;
+    }
+  }
+}
+
+uint64 hashBytes(uint64 hash, const uint8 *bytes, size_t size)
+{
+  uint64 result = hash;
+
+  for (size_t i = 0; i < size; i++)
+  {
+    result ^= bytes[i];
+    result *= 0x100000001B3ull;
+  }
+
+  return(result);
+}
+
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ull
+#define HASH_BLOCK_SIZE (1 << 20)
+
+// NOTE(ralntdir): To recognize the scene a checkpoint belongs to. FNV-1a
+// of each block of the file, on all the threads, and FNV-1a of those.
+// FNV-1a of the whole file would go a byte at a time for big scenes.
+uint64 hashFile(const char *filename)
+{
+  std::ifstream ifs(filename, std::ifstream::in | std::ifstream::binary);
+  ifs.seekg(0, std::ifstream::end);
+  std::streamoff size = ifs.good() ? (std::streamoff)ifs.tellg() : 0;
+  ifs.close();
+
+  int32 blocks = (int32)((size + HASH_BLOCK_SIZE - 1)/HASH_BLOCK_SIZE);
+  std::vector<uint64> blockHashes(blocks);
+
+  #pragma omp parallel if (blocks > 1)
+  {
+    std::ifstream block(filename, std::ifstream::in | std::ifstream::binary);
+    std::vector<char> buffer(HASH_BLOCK_SIZE);
+
+    #pragma omp for schedule(dynamic)
+    for (int32 i = 0; i < blocks; i++)
+    {
+      block.seekg((std::streamoff)i*HASH_BLOCK_SIZE);
+      block.read(&buffer[0], HASH_BLOCK_SIZE);
+      blockHashes[i] = hashBytes(FNV_OFFSET_BASIS, (uint8 *)&buffer[0], (size_t)block.gcount());
+      block.clear();
+    }
+  }
+
+  uint64 result = hashBytes(FNV_OFFSET_BASIS, (uint8 *)blockHashes.data(), blocks*sizeof(uint64));
+
+  return(result);
+}
+
+#define CHECKPOINT_MAGIC 0x4B435452 // "RTCK"
+// NOTE(ralntdir): 2 hashes the scene file by blocks, 3 has the number of
+// light samples.
+#define CHECKPOINT_VERSION 3
+
+struct checkpointHeader
+{
+  uint32 magic;
+  uint32 version;
+  int32 width;
+  int32 height;
+  uint64 seed;
+  uint64 sceneHash;
+
+  // NOTE(ralntdir): Of the scene, it changes what a sample estimates and
+  // how many random numbers it takes. Padded so the header has no holes.
+  int32 lightSamples;
+  int32 unused;
+};
+
+// NOTE(ralntdir): Written to a temporary file and renamed, so a crash
+// in the middle of a write never destroys the previous checkpoint.
+bool writeCheckpoint(accumulationBuffer *accum, uint64 sceneHash, int32 lightSamples, const char *filename)
+{
+  bool result = false;
+  std::string tempFileName = std::string(filename) + ".tmp";
+  std::ofstream ofs(tempFileName.c_str(), std::ofstream::out | std::ofstream::binary);
+
+  if (ofs.is_open())
+  {
+    size_t count = pixelCount(accum->width, accum->height);
+
+    checkpointHeader header = {};
+    header.magic = CHECKPOINT_MAGIC;
+    header.version = CHECKPOINT_VERSION;
+    header.width = accum->width;
+    header.height = accum->height;
+    header.seed = accum->seed;
+    header.sceneHash = sceneHash;
+    header.lightSamples = lightSamples;
+
+    ofs.write((char *)&header, sizeof(header));
+    ofs.write((char *)accum->color, ACCUMULATION_CHANNELS*count*sizeof(real32));
+    ofs.write((char *)accum->samples, count*sizeof(uint32));
+    ofs.write((char *)accum->series, count*sizeof(randomSeries));
+
+    result = ofs.good();
+    ofs.close();
+
+    result = result && (rename(tempFileName.c_str(), filename) == 0);
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): accum has to be allocated already, the checkpoint is
+// only accepted if it was made for the same image size, seed, scene and
+// light samples.
+bool readCheckpoint(accumulationBuffer *accum, uint64 sceneHash, int32 lightSamples, const char *filename)
+{
+  bool result = false;
+  std::ifstream ifs(filename, std::ifstream::in | std::ifstream::binary);
+
+  if (ifs.is_open())
+  {
+    size_t count = pixelCount(accum->width, accum->height);
+
+    checkpointHeader header = {};
+    ifs.read((char *)&header, sizeof(header));
+
+    if (ifs.good() &&
+        (header.magic == CHECKPOINT_MAGIC) &&
+        (header.version == CHECKPOINT_VERSION) &&
+        (header.width == accum->width) &&
+        (header.height == accum->height) &&
+        (header.seed == accum->seed) &&
+        (header.sceneHash == sceneHash) &&
+        (header.lightSamples == lightSamples))
+    {
+      ifs.read((char *)accum->color, ACCUMULATION_CHANNELS*count*sizeof(real32));
+      ifs.read((char *)accum->samples, count*sizeof(uint32));
+      ifs.read((char *)accum->series, count*sizeof(randomSeries));
+
+      result = ifs.good();
+    }
+
+    ifs.close();
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): Checkpoints are written from a copy of the buffer in
+// their own thread, the render threads only wait for the copy.
+struct checkpointWriter
+{
+  const char *filename;
+  uint64 sceneHash;
+  int32 lightSamples;
+
+  accumulationBuffer snapshot;
+  std::thread thread;
+  std::atomic<bool> busy;
+  std::atomic<bool> failed;
+};
+
+void checkpointWriterThread(checkpointWriter *writer)
+{
+  if (!writeCheckpoint(&writer->snapshot, writer->sceneHash, writer->lightSamples, writer->filename))
+  {
+    writer->failed = true;
+  }
+  writer->busy = false;
+}
+
+// NOTE(ralntdir): Returns false if the previous write is still going on,
+// in that case this checkpoint is skipped.
+bool startCheckpoint(checkpointWriter *writer, accumulationBuffer *accum)
+{
+  bool result = false;
+
+  if (!writer->busy)
+  {
+    if (writer->thread.joinable())
+    {
+      writer->thread.join();
+    }
+
+    if (!writer->snapshot.color)
+    {
+      writer->snapshot = allocateAccumulationBuffer(accum->width, accum->height, accum->seed);
+    }
+    copyAccumulationBuffer(&writer->snapshot, accum);
+
+    writer->busy = true;
+    writer->thread = std::thread(checkpointWriterThread, writer);
+    result = true;
+  }
+
+  return(result);
+}
+
+void finishCheckpoints(checkpointWriter *writer)
+{
+  if (writer->thread.joinable())
+  {
+    writer->thread.join();
+  }
+  freeAccumulationBuffer(&writer->snapshot);
+}
+
+#endif
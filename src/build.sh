@@ -7,4 +7,4 @@ then
   mkdir $BUILDDIR
 fi
 
-g++ -Wall -o ../build/program $1 `sdl2-config --cflags --libs` --std=c++11 -lSDL2_image -fopenmp
+g++ -Wall -O2 -fno-math-errno -o ../build/program $1 `sdl2-config --cflags --libs` --std=c++11 -lSDL2_image -fopenmp -pthread
@@ -0,0 +1,469 @@
+#ifndef BVH_H
+#define BVH_H
+
+// NOTE(ralntdir): Bounding volume hierarchy over anything that has a
+// bounding box. It only knows about boxes and indices, what an index
+// means (a mesh, an instance) is up to whoever traverses it. The same
+// code builds the per object hierarchies and the one over the scene.
+
+// NOTE(ralntdir): A leaf has count > 0 and its primitives are
+// indices[first..first+count). An inner node has count == 0 and its
+// children are nodes[first] and nodes[first+1].
+struct bvhNode
+{
+  aabb bounds;
+  int32 first;
+  int32 count;
+};
+
+struct bvhStats
+{
+  int32 primitives;
+  int32 unbounded;
+  int32 nodes;
+  int32 leaves;
+  int32 maxDepth;
+  real32 sahCost;
+  real64 buildMilliseconds;
+};
+
+struct bvh
+{
+  std::vector<bvhNode> nodes;
+  std::vector<int32> indices;
+
+  // NOTE(ralntdir): Primitives without bounds (planes), they are
+  // tested by every ray.
+  std::vector<int32> unbounded;
+
+  bvhStats stats;
+};
+
+#define BVH_BINS 16
+#define BVH_MAX_LEAF_SIZE 4
+#define BVH_MAX_DEPTH 48
+// NOTE(ralntdir): Cost of visiting a node relative to testing a primitive.
+#define BVH_TRAVERSAL_COST 1.0f
+// NOTE(ralntdir): Trees over more primitives than this are built on all
+// the threads, and so are the subtrees that big inside them.
+#define BVH_PARALLEL_SIZE 4096
+// NOTE(ralntdir): A refitted tree is built again when its SAH cost grows
+// past this many times the cost it had when it was built.
+#define BVH_MAX_REFIT_COST 1.5f
+
+real32 surfaceArea(aabb box)
+{
+  vec3 d = box.max - box.min;
+  real32 result = 2.0f*(d.x*d.y + d.y*d.z + d.z*d.x);
+
+  return(result);
+}
+
+vec3 centroid(aabb box)
+{
+  vec3 result = 0.5f*(box.min + box.max);
+
+  return(result);
+}
+
+inline int32 binIndex(vec3 point, int32 axis, real32 axisMin, real32 scale)
+{
+  int32 result = (int32)((point.e[axis] - axisMin)*scale);
+  result = (result >= BVH_BINS) ? BVH_BINS - 1 : result;
+
+  return(result);
+}
+
+// NOTE(ralntdir): Binned SAH split of indices[first..first+count). Returns
+// where the right half starts, or -1 if not splitting is cheaper. The
+// bins of the three axes are filled in the same pass over the
+// primitives, and the bounds of both halves come from the bins.
+int32 partitionSAH(std::vector<int32> &indices, std::vector<aabb> &bounds,
+                   int32 first, int32 count, aabb nodeBounds,
+                   aabb *leftBounds, aabb *rightBounds)
+{
+  aabb centroidBounds = emptyBounds();
+  for (int32 i = first; i < first + count; i++)
+  {
+    centroidBounds = grow(centroidBounds, centroid(bounds[indices[i]]));
+  }
+
+  // NOTE(ralntdir): A scale of 0 marks an axis where all the centroids
+  // are in the same spot.
+  real32 scale[3];
+  for (int32 axis = 0; axis < 3; axis++)
+  {
+    real32 extent = centroidBounds.max.e[axis] - centroidBounds.min.e[axis];
+    scale[axis] = (extent > 0.0f) ? BVH_BINS/extent : 0.0f;
+  }
+
+  aabb binBounds[3][BVH_BINS];
+  int32 binCount[3][BVH_BINS] = {};
+  for (int32 axis = 0; axis < 3; axis++)
+  {
+    for (int32 b = 0; b < BVH_BINS; b++)
+    {
+      binBounds[axis][b] = emptyBounds();
+    }
+  }
+
+  for (int32 i = first; i < first + count; i++)
+  {
+    aabb box = bounds[indices[i]];
+    vec3 center = centroid(box);
+
+    for (int32 axis = 0; axis < 3; axis++)
+    {
+      if (scale[axis] > 0.0f)
+      {
+        int32 b = binIndex(center, axis, centroidBounds.min.e[axis], scale[axis]);
+        binCount[axis][b]++;
+        binBounds[axis][b] = grow(binBounds[axis][b], box);
+      }
+    }
+  }
+
+  real32 bestCost = FLT_MAX;
+  int32 bestAxis = -1;
+  int32 bestBin = -1;
+
+  for (int32 axis = 0; axis < 3; axis++)
+  {
+    if (scale[axis] == 0.0f)
+    {
+      continue;
+    }
+
+    // NOTE(ralntdir): Sweep from the right to get the cost of every
+    // right half, then from the left to evaluate every split plane.
+    real32 rightArea[BVH_BINS];
+    int32 rightCount[BVH_BINS];
+    aabb rightBox = emptyBounds();
+    int32 rightSum = 0;
+    for (int32 b = BVH_BINS - 1; b > 0; b--)
+    {
+      rightBox = grow(rightBox, binBounds[axis][b]);
+      rightSum += binCount[axis][b];
+      rightArea[b] = rightSum ? surfaceArea(rightBox) : 0.0f;
+      rightCount[b] = rightSum;
+    }
+
+    aabb leftBox = emptyBounds();
+    int32 leftSum = 0;
+    for (int32 b = 0; b < BVH_BINS - 1; b++)
+    {
+      leftBox = grow(leftBox, binBounds[axis][b]);
+      leftSum += binCount[axis][b];
+      real32 leftArea = leftSum ? surfaceArea(leftBox) : 0.0f;
+
+      real32 cost = leftArea*leftSum + rightArea[b+1]*rightCount[b+1];
+      if ((leftSum > 0) && (rightCount[b+1] > 0) && (cost < bestCost))
+      {
+        bestCost = cost;
+        bestAxis = axis;
+        bestBin = b;
+      }
+    }
+  }
+
+  int32 result = -1;
+
+  real32 leafCost = count*surfaceArea(nodeBounds);
+  real32 splitCost = BVH_TRAVERSAL_COST*surfaceArea(nodeBounds) + bestCost;
+
+  if ((bestAxis != -1) && ((splitCost < leafCost) || (count > BVH_MAX_LEAF_SIZE)))
+  {
+    real32 axisMin = centroidBounds.min.e[bestAxis];
+
+    int32 left = first;
+    int32 right = first + count - 1;
+    while (left <= right)
+    {
+      int32 b = binIndex(centroid(bounds[indices[left]]), bestAxis, axisMin, scale[bestAxis]);
+      if (b <= bestBin)
+      {
+        left++;
+      }
+      else
+      {
+        int32 temp = indices[left];
+        indices[left] = indices[right];
+        indices[right] = temp;
+        right--;
+      }
+    }
+
+    *leftBounds = emptyBounds();
+    *rightBounds = emptyBounds();
+    for (int32 b = 0; b < BVH_BINS; b++)
+    {
+      if (b <= bestBin)
+      {
+        *leftBounds = grow(*leftBounds, binBounds[bestAxis][b]);
+      }
+      else
+      {
+        *rightBounds = grow(*rightBounds, binBounds[bestAxis][b]);
+      }
+    }
+
+    result = left;
+  }
+  else if ((bestAxis == -1) && (count > BVH_MAX_LEAF_SIZE))
+  {
+    // NOTE(ralntdir): All the centroids are in the same spot, SAH can't
+    // tell them apart, so they're just split in half.
+    result = first + count/2;
+
+    *leftBounds = emptyBounds();
+    *rightBounds = emptyBounds();
+    for (int32 i = first; i < result; i++)
+    {
+      *leftBounds = grow(*leftBounds, bounds[indices[i]]);
+    }
+    for (int32 i = result; i < first + count; i++)
+    {
+      *rightBounds = grow(*rightBounds, bounds[indices[i]]);
+    }
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): Big subtrees are built in their own task. The nodes
+// are all allocated up front (a tree over n primitives never has more
+// than 2n - 1), and the children of a node take the next two free ones,
+// so they still come after their parent, in whatever order the threads
+// get there. The tree is the same one a single thread builds, only where
+// its nodes end up in the array changes.
+struct bvhBuilder
+{
+  bvh *tree;
+  std::vector<aabb> *bounds;
+  std::atomic<int32> nodeCount;
+};
+
+void subdivide(bvhBuilder *builder, int32 nodeIndex, int32 depth)
+{
+  bvh *tree = builder->tree;
+  std::vector<aabb> &bounds = *builder->bounds;
+  bvhNode node = tree->nodes[nodeIndex];
+
+  int32 split = -1;
+  aabb leftBounds = {};
+  aabb rightBounds = {};
+  if ((node.count > 1) && (depth < BVH_MAX_DEPTH))
+  {
+    split = partitionSAH(tree->indices, bounds, node.first, node.count, node.bounds,
+                         &leftBounds, &rightBounds);
+  }
+
+  if (split != -1)
+  {
+    int32 leftIndex = builder->nodeCount.fetch_add(2);
+
+    bvhNode left = {};
+    left.first = node.first;
+    left.count = split - node.first;
+    left.bounds = leftBounds;
+
+    bvhNode right = {};
+    right.first = split;
+    right.count = node.first + node.count - split;
+    right.bounds = rightBounds;
+
+    tree->nodes[leftIndex] = left;
+    tree->nodes[leftIndex + 1] = right;
+
+    tree->nodes[nodeIndex].first = leftIndex;
+    tree->nodes[nodeIndex].count = 0;
+
+    if (left.count > BVH_PARALLEL_SIZE)
+    {
+      #pragma omp task
+      subdivide(builder, leftIndex, depth + 1);
+    }
+    else
+    {
+      subdivide(builder, leftIndex, depth + 1);
+    }
+    subdivide(builder, leftIndex + 1, depth + 1);
+  }
+}
+
+// NOTE(ralntdir): SAH cost of the finished tree, relative to the root:
+// sum of area(node)/area(root) times the cost of the node.
+real32 sahCost(bvh *tree)
+{
+  real32 result = 0.0f;
+
+  if (!tree->nodes.empty())
+  {
+    real32 rootArea = surfaceArea(tree->nodes[0].bounds);
+    real32 invRootArea = (rootArea > 0.0f) ? 1.0f/rootArea : 0.0f;
+
+    for (size_t i = 0; i < tree->nodes.size(); i++)
+    {
+      bvhNode *node = &tree->nodes[i];
+      real32 cost = node->count ? (real32)node->count : BVH_TRAVERSAL_COST;
+      result += surfaceArea(node->bounds)*invRootArea*cost;
+    }
+  }
+
+  return(result);
+}
+
+void buildBVH(bvh *tree, std::vector<aabb> &bounds)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  tree->nodes.clear();
+  tree->indices.clear();
+  tree->unbounded.clear();
+  tree->stats = {};
+
+  bvhNode root = {};
+  root.bounds = emptyBounds();
+
+  for (int32 i = 0; i < (int32)bounds.size(); i++)
+  {
+    if (isInfinite(bounds[i]))
+    {
+      tree->unbounded.push_back(i);
+    }
+    else
+    {
+      tree->indices.push_back(i);
+      root.bounds = grow(root.bounds, bounds[i]);
+    }
+  }
+
+  root.first = 0;
+  root.count = (int32)tree->indices.size();
+
+  if (root.count > 0)
+  {
+    bvhBuilder builder;
+    builder.tree = tree;
+    builder.bounds = &bounds;
+    builder.nodeCount = 1;
+
+    tree->nodes.resize(2*root.count - 1);
+    tree->nodes[0] = root;
+
+    // NOTE(ralntdir): The tasks are all done at the end of the region.
+    #pragma omp parallel if (root.count > BVH_PARALLEL_SIZE)
+    #pragma omp single
+    subdivide(&builder, 0, 1);
+
+    tree->nodes.resize(builder.nodeCount);
+    tree->nodes.shrink_to_fit();
+  }
+
+  tree->stats.primitives = root.count;
+  tree->stats.unbounded = (int32)tree->unbounded.size();
+  tree->stats.nodes = (int32)tree->nodes.size();
+
+  // NOTE(ralntdir): Parents come before their children.
+  std::vector<int32> depths(tree->nodes.size(), 1);
+  for (size_t i = 0; i < tree->nodes.size(); i++)
+  {
+    bvhNode *node = &tree->nodes[i];
+
+    if (node->count)
+    {
+      tree->stats.leaves++;
+    }
+    else
+    {
+      depths[node->first] = depths[i] + 1;
+      depths[node->first + 1] = depths[i] + 1;
+    }
+
+    tree->stats.maxDepth = (depths[i] > tree->stats.maxDepth) ? depths[i] : tree->stats.maxDepth;
+  }
+  tree->stats.sahCost = sahCost(tree);
+
+  std::chrono::duration<real64, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  tree->stats.buildMilliseconds = elapsed.count();
+}
+
+// NOTE(ralntdir): Keeps the topology of the tree and only recomputes
+// the bounds of the nodes, for primitives that moved but are the same
+// ones. Children always come after their parent in nodes, so going
+// backwards visits them first. Returns false if a primitive changed from
+// bounded to unbounded or back, that needs a new tree.
+bool refitBVH(bvh *tree, std::vector<aabb> &bounds)
+{
+  bool result = true;
+
+  for (size_t i = 0; result && (i < tree->indices.size()); i++)
+  {
+    result = !isInfinite(bounds[tree->indices[i]]);
+  }
+  for (size_t i = 0; result && (i < tree->unbounded.size()); i++)
+  {
+    result = isInfinite(bounds[tree->unbounded[i]]);
+  }
+
+  for (int32 i = (int32)tree->nodes.size() - 1; result && (i >= 0); i--)
+  {
+    bvhNode *node = &tree->nodes[i];
+
+    if (node->count)
+    {
+      node->bounds = emptyBounds();
+      for (int32 j = node->first; j < node->first + node->count; j++)
+      {
+        node->bounds = grow(node->bounds, bounds[tree->indices[j]]);
+      }
+    }
+    else
+    {
+      node->bounds = grow(tree->nodes[node->first].bounds, tree->nodes[node->first + 1].bounds);
+    }
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): Refits if the tree is still good for the new bounds,
+// builds it again otherwise. stats keep the numbers of the last build.
+// Returns true if it was built again.
+bool updateBVH(bvh *tree, std::vector<aabb> &bounds)
+{
+  bool result = !refitBVH(tree, bounds) ||
+                (sahCost(tree) > BVH_MAX_REFIT_COST*tree->stats.sahCost);
+
+  if (result)
+  {
+    buildBVH(tree, bounds);
+  }
+
+  return(result);
+}
+
+size_t bvhMemory(bvh *tree)
+{
+  size_t result = tree->nodes.size()*sizeof(bvhNode) +
+                  (tree->indices.size() + tree->unbounded.size())*sizeof(int32);
+
+  return(result);
+}
+
+void printBVHStats(const char *name, bvh *tree)
+{
+  bvhStats *stats = &tree->stats;
+
+  std::cout << name << ": " << stats->primitives << " primitives";
+  if (stats->unbounded)
+  {
+    std::cout << " (+" << stats->unbounded << " unbounded)";
+  }
+  std::cout << ", " << stats->nodes << " nodes, " << stats->leaves << " leaves"
+            << ", depth " << stats->maxDepth
+            << ", SAH cost " << stats->sahCost
+            << ", built in " << stats->buildMilliseconds << " ms\n";
+}
+
+#endif
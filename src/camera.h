@@ -0,0 +1,216 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+// NOTE(ralntdir): A thin lens camera. The scene file either places it
+// with a position, a point to look at, up and a vertical field of view,
+// or gives the four corners of the image plane relative to the position
+// (the old format). Either way setupCamera() turns that into an image
+// plane and a lens, and making a ray only takes a few multiply-adds.
+//
+// With an aperture the rays start somewhere on the lens and go through
+// the point of the image plane, moved to the focus distance, that the
+// pixel looks at. Points at that distance stay sharp, the rest blur.
+
+struct camera
+{
+  vec3 position;
+
+  // NOTE(ralntdir): Placed with a target. fov is vertical, in degrees.
+  bool aimed;
+  vec3 lookAt;
+  vec3 up;
+  real32 fov;
+
+  // NOTE(ralntdir): Placed with the corners, relative to position.
+  vec3 ul;
+  vec3 ur;
+  vec3 lr;
+  vec3 ll;
+
+  // NOTE(ralntdir): Diameter of the lens, 0 is a pinhole. A focus
+  // distance of 0 focuses on lookAt, or on the image plane of the
+  // corners.
+  real32 aperture;
+  real32 focusDistance;
+
+  // NOTE(ralntdir): Computed by setupCamera(). The image plane relative
+  // to position, at the focus distance, and the axes of the lens scaled
+  // by its radius (0 for a pinhole).
+  vec3 lowerLeft;
+  vec3 horizontal;
+  vec3 vertical;
+  vec3 lensU;
+  vec3 lensV;
+  bool thinLens;
+};
+
+camera defaultCamera()
+{
+  camera result = {};
+
+  result.up = { 0.0f, 1.0f, 0.0f };
+  result.fov = 90.0f;
+
+  return(result);
+}
+
+// NOTE(ralntdir): aspect is width/height of the image, only used when
+// the camera is aimed, the corners already have a shape.
+void setupCamera(camera *view, real32 aspect)
+{
+  real32 focusDistance = view->focusDistance;
+
+  if (view->aimed)
+  {
+    vec3 backward = normalize(view->position - view->lookAt);
+    vec3 right = normalize(crossProduct(view->up, backward));
+    vec3 up = crossProduct(backward, right);
+
+    real32 halfHeight = tan(0.5f*view->fov*M_PI/180.0);
+    real32 halfWidth = aspect*halfHeight;
+
+    view->horizontal = (2.0f*halfWidth)*right;
+    view->vertical = (2.0f*halfHeight)*up;
+    view->lowerLeft = -backward - halfWidth*right - halfHeight*up;
+
+    if (focusDistance <= 0.0f)
+    {
+      focusDistance = length(view->lookAt - view->position);
+    }
+  }
+  else
+  {
+    view->horizontal = view->ur - view->ul;
+    view->vertical = view->ul - view->ll;
+    view->lowerLeft = view->ll;
+  }
+
+  view->thinLens = (view->aperture > 0.0f);
+  view->lensU = {};
+  view->lensV = {};
+
+  if (view->thinLens)
+  {
+    vec3 center = view->lowerLeft + 0.5f*view->horizontal + 0.5f*view->vertical;
+    vec3 forward = normalize(crossProduct(view->vertical, view->horizontal));
+    real32 planeDistance = fabs(dotProduct(center, forward));
+
+    // NOTE(ralntdir): The rays to a point on the plane go through it from
+    // anywhere on the lens, so the plane has to be at the focus distance.
+    if ((focusDistance > 0.0f) && (planeDistance > 0.0f))
+    {
+      real32 scale = focusDistance/planeDistance;
+      view->lowerLeft = scale*view->lowerLeft;
+      view->horizontal = scale*view->horizontal;
+      view->vertical = scale*view->vertical;
+    }
+
+    real32 lensRadius = 0.5f*view->aperture;
+    view->lensU = lensRadius*normalize(view->horizontal);
+    view->lensV = lensRadius*normalize(view->vertical);
+  }
+}
+
+// NOTE(ralntdir): Uniform on the unit disk, Shirley and Chiu's concentric
+// mapping, which keeps strata of the square together on the disk.
+void sampleDisk(real32 u1, real32 u2, real32 *x, real32 *y)
+{
+  real32 a = 2.0f*u1 - 1.0f;
+  real32 b = 2.0f*u2 - 1.0f;
+
+  real32 r = 0.0f;
+  real32 phi = 0.0f;
+  if ((a != 0.0f) || (b != 0.0f))
+  {
+    if (fabs(a) > fabs(b))
+    {
+      r = a;
+      phi = (M_PI/4.0)*(b/a);
+    }
+    else
+    {
+      r = b;
+      phi = (M_PI/2.0) - (M_PI/4.0)*(a/b);
+    }
+  }
+
+  *x = r*cos(phi);
+  *y = r*sin(phi);
+}
+
+// NOTE(ralntdir): Camera rays are made in batches, as arrays of each
+// coordinate, so the loop in generateCameraRays() is vectorized.
+#define CAMERA_BATCH 64
+
+struct cameraBatch
+{
+  // NOTE(ralntdir): In: where on the image plane (0..1 from the lower
+  // left corner) and where on the lens (unit disk).
+  real32 u[CAMERA_BATCH];
+  real32 v[CAMERA_BATCH];
+  real32 lensX[CAMERA_BATCH];
+  real32 lensY[CAMERA_BATCH];
+
+  // NOTE(ralntdir): Out: the origin and the normalized direction.
+  real32 originX[CAMERA_BATCH];
+  real32 originY[CAMERA_BATCH];
+  real32 originZ[CAMERA_BATCH];
+  real32 directionX[CAMERA_BATCH];
+  real32 directionY[CAMERA_BATCH];
+  real32 directionZ[CAMERA_BATCH];
+};
+
+// NOTE(ralntdir): lensX and lensY are only read by a thin lens camera.
+void generateCameraRays(camera *view, cameraBatch *batch, int32 count)
+{
+  vec3 p = view->position;
+  vec3 l = view->lowerLeft;
+  vec3 h = view->horizontal;
+  vec3 w = view->vertical;
+
+  if (view->thinLens)
+  {
+    vec3 a = view->lensU;
+    vec3 b = view->lensV;
+
+    #pragma omp simd
+    for (int32 i = 0; i < count; i++)
+    {
+      real32 offsetX = batch->lensX[i]*a.x + batch->lensY[i]*b.x;
+      real32 offsetY = batch->lensX[i]*a.y + batch->lensY[i]*b.y;
+      real32 offsetZ = batch->lensX[i]*a.z + batch->lensY[i]*b.z;
+
+      real32 x = (l.x + batch->u[i]*h.x) + batch->v[i]*w.x - offsetX;
+      real32 y = (l.y + batch->u[i]*h.y) + batch->v[i]*w.y - offsetY;
+      real32 z = (l.z + batch->u[i]*h.z) + batch->v[i]*w.z - offsetZ;
+      real32 k = 1.0f/sqrtf(x*x + y*y + z*z);
+
+      batch->originX[i] = p.x + offsetX;
+      batch->originY[i] = p.y + offsetY;
+      batch->originZ[i] = p.z + offsetZ;
+      batch->directionX[i] = k*x;
+      batch->directionY[i] = k*y;
+      batch->directionZ[i] = k*z;
+    }
+  }
+  else
+  {
+    #pragma omp simd
+    for (int32 i = 0; i < count; i++)
+    {
+      real32 x = (l.x + batch->u[i]*h.x) + batch->v[i]*w.x;
+      real32 y = (l.y + batch->u[i]*h.y) + batch->v[i]*w.y;
+      real32 z = (l.z + batch->u[i]*h.z) + batch->v[i]*w.z;
+      real32 k = 1.0f/sqrtf(x*x + y*y + z*z);
+
+      batch->originX[i] = p.x;
+      batch->originY[i] = p.y;
+      batch->originZ[i] = p.z;
+      batch->directionX[i] = k*x;
+      batch->directionY[i] = k*y;
+      batch->directionZ[i] = k*z;
+    }
+  }
+}
+
+#endif
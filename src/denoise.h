@@ -0,0 +1,333 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+// NOTE(ralntdir): Edge-avoiding A-Trous wavelet filter (Dammertz et al.
+// 2010). A 5x5 B3-spline kernel is applied several times with growing
+// holes between the taps (1, 2, 4, ...), and every tap is weighted by
+// how similar its color, normal, depth and albedo are to the center
+// pixel, so the noise gets blurred away but the edges don't.
+
+// NOTE(ralntdir): exp(-d) for the filter weights, d >= 0, as the
+// limit (1 + d/n)^-n with n = 16. expf() is a library call, which
+// stops the compiler from vectorizing the loop, and the weights don't
+// need to be exact, they only have to fall off quickly. For huge d
+// the power overflows to infinity and the weight becomes 0.
+inline real32 weightFalloff(real32 d)
+{
+  real32 a = 1.0f + d*(1.0f/16.0f);
+  a = a*a;
+  a = a*a;
+  a = a*a;
+  a = a*a;
+
+  real32 result = 1.0f/a;
+
+  return(result);
+}
+
+// NOTE(ralntdir): What the camera ray saw at its first hit, averaged
+// over the samples of the pixel, plus how noisy the pixel still is
+// (variance of the mean of its luminance). They guide the filter.
+struct auxBuffers
+{
+  framebuffer albedo;
+  framebuffer normal;
+  framebuffer depth;
+  framebuffer variance;
+};
+
+// NOTE(ralntdir): Iteration i reaches 2^i pixels away, 10 already goes
+// 1024 pixels out, and the shift is undefined from 32 on.
+#define MAX_DENOISE_ITERATIONS 10
+
+struct denoiseSettings
+{
+  // NOTE(ralntdir): 1 to MAX_DENOISE_ITERATIONS.
+  int32 iterations;
+
+  real32 sigmaColor;
+  real32 sigmaNormal;
+  real32 sigmaDepth;
+  real32 sigmaAlbedo;
+};
+
+denoiseSettings defaultDenoiseSettings()
+{
+  denoiseSettings result = {};
+
+  result.iterations = 5;
+  result.sigmaColor = 1.0;
+  result.sigmaNormal = 0.3;
+  result.sigmaDepth = 0.1;
+  result.sigmaAlbedo = 0.1;
+
+  return(result);
+}
+
+auxBuffers allocateAuxBuffers(int32 width, int32 height)
+{
+  auxBuffers result = {};
+
+  result.albedo = allocateFramebuffer(width, height);
+  result.normal = allocateFramebuffer(width, height);
+  result.depth = allocateFramebuffer(width, height);
+  result.variance = allocateFramebuffer(width, height);
+
+  return(result);
+}
+
+void freeAuxBuffers(auxBuffers *aux)
+{
+  freeFramebuffer(&aux->albedo);
+  freeFramebuffer(&aux->normal);
+  freeFramebuffer(&aux->depth);
+  freeFramebuffer(&aux->variance);
+}
+
+// NOTE(ralntdir): image.pfm -> image_albedo.pfm
+std::string auxFileName(const char *hdrFileName, const char *suffix)
+{
+  std::string result = hdrFileName;
+  size_t dot = result.rfind('.');
+
+  if (dot == std::string::npos)
+  {
+    dot = result.size();
+  }
+  result.insert(dot, std::string("_") + suffix);
+
+  return(result);
+}
+
+bool writeAuxBuffers(auxBuffers *aux, const char *hdrFileName)
+{
+  bool result = writePFM(&aux->albedo, auxFileName(hdrFileName, "albedo").c_str()) &&
+                writePFM(&aux->normal, auxFileName(hdrFileName, "normal").c_str()) &&
+                writePFM(&aux->depth, auxFileName(hdrFileName, "depth").c_str()) &&
+                writePFM(&aux->variance, auxFileName(hdrFileName, "variance").c_str());
+
+  return(result);
+}
+
+bool readAuxBuffers(auxBuffers *aux, const char *hdrFileName)
+{
+  bool result = readPFM(&aux->albedo, auxFileName(hdrFileName, "albedo").c_str()) &&
+                readPFM(&aux->normal, auxFileName(hdrFileName, "normal").c_str()) &&
+                readPFM(&aux->depth, auxFileName(hdrFileName, "depth").c_str()) &&
+                readPFM(&aux->variance, auxFileName(hdrFileName, "variance").c_str());
+
+  return(result);
+}
+
+// NOTE(ralntdir): Each buffer is read from its own file, a stale one left
+// next to the image can have another size.
+bool auxBuffersMatch(auxBuffers *aux, int32 width, int32 height)
+{
+  bool result = (aux->albedo.width == width) && (aux->albedo.height == height) &&
+                (aux->normal.width == width) && (aux->normal.height == height) &&
+                (aux->depth.width == width) && (aux->depth.height == height) &&
+                (aux->variance.width == width) && (aux->variance.height == height);
+
+  return(result);
+}
+
+// NOTE(ralntdir): The filter works on planar copies of the buffers, so
+// for a given tap the inner loop over x reads every plane contiguously
+// and can be vectorized.
+struct denoisePlanes
+{
+  int32 width;
+  int32 height;
+
+  real32 *r;
+  real32 *g;
+  real32 *b;
+
+  real32 *nx;
+  real32 *ny;
+  real32 *nz;
+  real32 *ar;
+  real32 *ag;
+  real32 *ab;
+  real32 *z;
+  real32 *variance;
+};
+
+void denoise(framebuffer *fb, auxBuffers *aux, denoiseSettings settings)
+{
+  int32 width = fb->width;
+  int32 height = fb->height;
+  size_t count = pixelCount(width, height);
+
+  real32 *memory = new real32[14*count];
+
+  denoisePlanes in = {};
+  in.width = width;
+  in.height = height;
+  in.r = memory;
+  in.g = memory + count;
+  in.b = memory + 2*count;
+  in.nx = memory + 3*count;
+  in.ny = memory + 4*count;
+  in.nz = memory + 5*count;
+  in.ar = memory + 6*count;
+  in.ag = memory + 7*count;
+  in.ab = memory + 8*count;
+  in.z = memory + 9*count;
+  in.variance = memory + 13*count;
+
+  denoisePlanes out = in;
+  out.r = memory + 10*count;
+  out.g = memory + 11*count;
+  out.b = memory + 12*count;
+
+  // NOTE(ralntdir): Divide the albedo out, so the filter only has to
+  // smooth the lighting and the texture of the surfaces stays sharp.
+  // Channels without albedo are left as they are.
+  #pragma omp parallel for
+  for (size_t i = 0; i < count; i++)
+  {
+    in.nx[i] = aux->normal.pixels[3*i];
+    in.ny[i] = aux->normal.pixels[3*i + 1];
+    in.nz[i] = aux->normal.pixels[3*i + 2];
+    in.ar[i] = aux->albedo.pixels[3*i];
+    in.ag[i] = aux->albedo.pixels[3*i + 1];
+    in.ab[i] = aux->albedo.pixels[3*i + 2];
+    in.z[i] = aux->depth.pixels[3*i];
+    in.variance[i] = aux->variance.pixels[3*i];
+
+    real32 *planes[3] = { in.r, in.g, in.b };
+    real32 *albedo = aux->albedo.pixels + 3*i;
+    for (int32 c = 0; c < 3; c++)
+    {
+      real32 factor = (albedo[c] > 0.01f) ? albedo[c] : 1.0f;
+      planes[c][i] = fb->pixels[3*i + c]/factor;
+    }
+  }
+
+  real32 kernel[5] = { 1.0f/16.0f, 1.0f/4.0f, 3.0f/8.0f, 1.0f/4.0f, 1.0f/16.0f };
+
+  real32 invSigmaNormal = 1.0f/(settings.sigmaNormal*settings.sigmaNormal);
+  real32 invSigmaDepth = 1.0f/(settings.sigmaDepth*settings.sigmaDepth);
+  real32 invSigmaAlbedo = 1.0f/(settings.sigmaAlbedo*settings.sigmaAlbedo);
+
+  for (int32 iteration = 0; iteration < settings.iterations; iteration++)
+  {
+    int32 step = 1 << iteration;
+    // NOTE(ralntdir): The color test is relative to how noisy the
+    // pixel is, a converged pixel doesn't get blurred at all. Every
+    // iteration has already removed part of the noise, so the test
+    // gets stricter.
+    real32 sigmaColor = settings.sigmaColor*pow(2.0, -iteration);
+    real32 sigmaColor2 = sigmaColor*sigmaColor;
+
+    #pragma omp parallel for
+    for (int32 y = 0; y < height; y++)
+    {
+      real32 *sumR = new real32[4*width];
+      real32 *sumG = sumR + width;
+      real32 *sumB = sumR + 2*width;
+      real32 *sumW = sumR + 3*width;
+
+      for (int32 x = 0; x < width; x++)
+      {
+        sumR[x] = 0.0f;
+        sumG[x] = 0.0f;
+        sumB[x] = 0.0f;
+        sumW[x] = 0.0f;
+      }
+
+      for (int32 ky = 0; ky < 5; ky++)
+      {
+        int32 qy = y + (ky - 2)*step;
+        if ((qy < 0) || (qy >= height))
+        {
+          continue;
+        }
+
+        for (int32 kx = 0; kx < 5; kx++)
+        {
+          int32 offset = (kx - 2)*step;
+          real32 h = kernel[kx]*kernel[ky];
+
+          // NOTE(ralntdir): Only the x for which the tap is inside the
+          // image, taps outside of it just don't contribute.
+          int32 xBegin = (offset < 0) ? -offset : 0;
+          int32 xEnd = (offset > 0) ? width - offset : width;
+
+          int32 p = y*width;
+          int32 q = qy*width + offset;
+
+          #pragma omp simd
+          for (int32 x = xBegin; x < xEnd; x++)
+          {
+            real32 dr = in.r[p + x] - in.r[q + x];
+            real32 dg = in.g[p + x] - in.g[q + x];
+            real32 db = in.b[p + x] - in.b[q + x];
+            real32 colorDistance = dr*dr + dg*dg + db*db;
+
+            real32 dnx = in.nx[p + x] - in.nx[q + x];
+            real32 dny = in.ny[p + x] - in.ny[q + x];
+            real32 dnz = in.nz[p + x] - in.nz[q + x];
+            real32 normalDistance = dnx*dnx + dny*dny + dnz*dnz;
+
+            // NOTE(ralntdir): Relative, so the same sigma works for
+            // near and far surfaces.
+            real32 dz = (in.z[p + x] - in.z[q + x])/(in.z[p + x] + 1e-3f);
+            real32 depthDistance = dz*dz;
+
+            real32 dar = in.ar[p + x] - in.ar[q + x];
+            real32 dag = in.ag[p + x] - in.ag[q + x];
+            real32 dab = in.ab[p + x] - in.ab[q + x];
+            real32 albedoDistance = dar*dar + dag*dag + dab*dab;
+
+            real32 invSigmaColor = 1.0f/(sigmaColor2*in.variance[p + x] + 1e-8f);
+
+            real32 w = h*weightFalloff(colorDistance*invSigmaColor +
+                                       normalDistance*invSigmaNormal +
+                                       depthDistance*invSigmaDepth +
+                                       albedoDistance*invSigmaAlbedo);
+
+            sumR[x] += w*in.r[q + x];
+            sumG[x] += w*in.g[q + x];
+            sumB[x] += w*in.b[q + x];
+            sumW[x] += w;
+          }
+        }
+      }
+
+      // NOTE(ralntdir): The center tap always has weight h(0)*h(0), so
+      // sumW is never zero.
+      #pragma omp simd
+      for (int32 x = 0; x < width; x++)
+      {
+        real32 invW = 1.0f/sumW[x];
+        out.r[y*width + x] = sumR[x]*invW;
+        out.g[y*width + x] = sumG[x]*invW;
+        out.b[y*width + x] = sumB[x]*invW;
+      }
+
+      delete[] sumR;
+    }
+
+    real32 *temp = in.r; in.r = out.r; out.r = temp;
+    temp = in.g; in.g = out.g; out.g = temp;
+    temp = in.b; in.b = out.b; out.b = temp;
+  }
+
+  #pragma omp parallel for
+  for (size_t i = 0; i < count; i++)
+  {
+    real32 *planes[3] = { in.r, in.g, in.b };
+    real32 *albedo = aux->albedo.pixels + 3*i;
+    for (int32 c = 0; c < 3; c++)
+    {
+      real32 factor = (albedo[c] > 0.01f) ? albedo[c] : 1.0f;
+      fb->pixels[3*i + c] = planes[c][i]*factor;
+    }
+  }
+
+  delete[] memory;
+}
+
+#endif
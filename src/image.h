@@ -0,0 +1,543 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+// NOTE(ralntdir): Everything that happens to an image after the rays
+// have been traced lives here. The renderer only writes linear,
+// unclamped radiance into a framebuffer; exposure, tone mapping and
+// the display encoding are applied afterwards, so they can be redone
+// from an HDR file without tracing anything again.
+
+enum tonemap_operator
+{
+  tonemapClamp,
+  tonemapReinhard,
+  tonemapACES,
+};
+
+struct tonemapSettings
+{
+  // NOTE(ralntdir): In stops, 0.0 leaves the radiance untouched.
+  real32 exposure;
+  tonemap_operator op;
+  bool srgb;
+};
+
+// NOTE(ralntdir): Interleaved RGB, row 0 is the top of the image.
+struct framebuffer
+{
+  int32 width;
+  int32 height;
+  real32 *pixels;
+};
+
+// NOTE(ralntdir): The pixels [minX, maxX) x [minY, maxY), row 0 is the
+// top of the image like in the framebuffer.
+struct imageRegion
+{
+  int32 minX;
+  int32 minY;
+  int32 maxX;
+  int32 maxY;
+};
+
+imageRegion fullRegion(int32 width, int32 height)
+{
+  imageRegion result = { 0, 0, width, height };
+
+  return(result);
+}
+
+inline bool isEmpty(imageRegion region)
+{
+  bool result = (region.minX >= region.maxX) || (region.minY >= region.maxY);
+
+  return(result);
+}
+
+imageRegion grow(imageRegion a, imageRegion b)
+{
+  imageRegion result = a;
+
+  if (isEmpty(a))
+  {
+    result = b;
+  }
+  else if (!isEmpty(b))
+  {
+    result.minX = (b.minX < a.minX) ? b.minX : a.minX;
+    result.minY = (b.minY < a.minY) ? b.minY : a.minY;
+    result.maxX = (b.maxX > a.maxX) ? b.maxX : a.maxX;
+    result.maxY = (b.maxY > a.maxY) ? b.maxY : a.maxY;
+  }
+
+  return(result);
+}
+
+imageRegion intersect(imageRegion a, imageRegion b)
+{
+  imageRegion result = {};
+
+  result.minX = (b.minX > a.minX) ? b.minX : a.minX;
+  result.minY = (b.minY > a.minY) ? b.minY : a.minY;
+  result.maxX = (b.maxX < a.maxX) ? b.maxX : a.maxX;
+  result.maxY = (b.maxY < a.maxY) ? b.maxY : a.maxY;
+
+  return(result);
+}
+
+// NOTE(ralntdir): Pixels are numbered with an int32 (y*width + x) all
+// over, so a whole image can have up to INT32_MAX of them. The channels
+// and the bytes of an image go past that, they're counted in size_t.
+inline bool validImageSize(int32 width, int32 height)
+{
+  bool result = (width > 0) && (height > 0) && ((uint64)width*height <= INT32_MAX);
+
+  return(result);
+}
+
+inline size_t pixelCount(int32 width, int32 height)
+{
+  size_t result = (size_t)width*height;
+
+  return(result);
+}
+
+framebuffer allocateFramebuffer(int32 width, int32 height)
+{
+  framebuffer result = {};
+
+  result.width = width;
+  result.height = height;
+  result.pixels = new real32[3*pixelCount(width, height)]();
+
+  return(result);
+}
+
+void freeFramebuffer(framebuffer *fb)
+{
+  delete[] fb->pixels;
+  fb->pixels = 0;
+  fb->width = 0;
+  fb->height = 0;
+}
+
+inline void setPixel(framebuffer *fb, int32 x, int32 y, vec3 col)
+{
+  real32 *pixel = fb->pixels + 3*((size_t)y*fb->width + x);
+
+  pixel[0] = col.r;
+  pixel[1] = col.g;
+  pixel[2] = col.b;
+}
+
+inline vec3 getPixel(framebuffer *fb, int32 x, int32 y)
+{
+  real32 *pixel = fb->pixels + 3*((size_t)y*fb->width + x);
+  vec3 result = { pixel[0], pixel[1], pixel[2] };
+
+  return(result);
+}
+
+bool parseTonemapOperator(const char *name, tonemap_operator *op)
+{
+  bool result = true;
+  std::string value = name;
+
+  if (value == "clamp")
+  {
+    *op = tonemapClamp;
+  }
+  else if (value == "reinhard")
+  {
+    *op = tonemapReinhard;
+  }
+  else if (value == "aces")
+  {
+    *op = tonemapACES;
+  }
+  else
+  {
+    result = false;
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): Portable Float Map. Scanlines are stored from bottom
+// to top and a negative scale means little endian, which is what we
+// write (and the only thing we accept back).
+bool writePFM(framebuffer *fb, const char *filename)
+{
+  bool result = false;
+  std::ofstream ofs(filename, std::ofstream::out | std::ofstream::binary);
+
+  if (ofs.is_open())
+  {
+    ofs << "PF\n";
+    ofs << fb->width << " " << fb->height << "\n";
+    ofs << "-1.0\n";
+
+    size_t rowSize = 3*(size_t)fb->width;
+    for (int32 y = fb->height-1; y >= 0; y--)
+    {
+      ofs.write((char *)(fb->pixels + y*rowSize), rowSize*sizeof(real32));
+    }
+
+    result = ofs.good();
+    ofs.close();
+  }
+
+  return(result);
+}
+
+bool readPFM(framebuffer *fb, const char *filename)
+{
+  bool result = false;
+  std::ifstream ifs(filename, std::ifstream::in | std::ifstream::binary);
+
+  if (ifs.is_open())
+  {
+    std::string magic;
+    int32 width = 0;
+    int32 height = 0;
+    real32 scale = 0.0;
+
+    ifs >> magic >> width >> height >> scale;
+    // NOTE(ralntdir): Exactly one whitespace character separates the
+    // header from the data.
+    ifs.get();
+
+    if ((magic == "PF") && validImageSize(width, height) && (scale < 0.0))
+    {
+      *fb = allocateFramebuffer(width, height);
+
+      size_t rowSize = 3*(size_t)width;
+      for (int32 y = height-1; y >= 0; y--)
+      {
+        ifs.read((char *)(fb->pixels + y*rowSize), rowSize*sizeof(real32));
+      }
+
+      result = ifs.good();
+      if (!result)
+      {
+        freeFramebuffer(fb);
+      }
+    }
+
+    ifs.close();
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): A tiled HDR image, for images too big to keep whole in
+// memory. The header, then the tiles in the order they were finished,
+// then the index: where each tile starts in the file, in row major
+// order of the tiles, 0 for a tile that isn't there (outside of a crop).
+// A tile is its pixels as interleaved RGB floats, row 0 at the top, and
+// the tiles at the right and bottom edges are cut to the image. The
+// index offset is written last, so it's 0 in a file that wasn't
+// finished.
+#define TILED_IMAGE_MAGIC 0x4C495452 // "RTIL"
+#define TILED_IMAGE_VERSION 1
+// NOTE(ralntdir): Only to reject broken headers, a tile is read whole.
+#define TILED_IMAGE_MAX_TILE_SIZE 4096
+
+struct tiledImageHeader
+{
+  uint32 magic;
+  uint32 version;
+  int32 width;
+  int32 height;
+  int32 tileSize;
+  int32 reserved;
+  uint64 indexOffset;
+};
+
+struct tiledImageWriter
+{
+  std::ofstream file;
+  tiledImageHeader header;
+  int32 tilesX;
+  int32 tilesY;
+  std::vector<uint64> index;
+  uint64 end;
+};
+
+inline int32 tileCount(int32 size, int32 tileSize)
+{
+  int32 result = size/tileSize + ((size % tileSize) ? 1 : 0);
+
+  return(result);
+}
+
+// NOTE(ralntdir): Tile index is in row major order of the tiles.
+imageRegion tileRegion(int32 width, int32 height, int32 tileSize, int32 index)
+{
+  int32 tilesX = tileCount(width, tileSize);
+  imageRegion result = {};
+
+  result.minX = (index % tilesX)*tileSize;
+  result.minY = (index / tilesX)*tileSize;
+  result.maxX = (width - result.minX > tileSize) ? result.minX + tileSize : width;
+  result.maxY = (height - result.minY > tileSize) ? result.minY + tileSize : height;
+
+  return(result);
+}
+
+bool startTiledImage(tiledImageWriter *writer, const char *filename, int32 width, int32 height, int32 tileSize)
+{
+  writer->file.open(filename, std::ofstream::out | std::ofstream::binary);
+
+  writer->header = {};
+  writer->header.magic = TILED_IMAGE_MAGIC;
+  writer->header.version = TILED_IMAGE_VERSION;
+  writer->header.width = width;
+  writer->header.height = height;
+  writer->header.tileSize = tileSize;
+
+  writer->tilesX = tileCount(width, tileSize);
+  writer->tilesY = tileCount(height, tileSize);
+  writer->index.assign((size_t)writer->tilesX*writer->tilesY, 0);
+  writer->end = sizeof(tiledImageHeader);
+
+  writer->file.write((char *)&writer->header, sizeof(tiledImageHeader));
+
+  bool result = writer->file.good();
+
+  return(result);
+}
+
+// NOTE(ralntdir): tile is the size of the tile, from tileRegion(). Safe
+// to call from several threads, the tiles go one after another.
+void writeTile(tiledImageWriter *writer, int32 index, framebuffer *tile)
+{
+  uint64 size = 3*(uint64)tile->width*tile->height*sizeof(real32);
+
+  #pragma omp critical(tiledImageWriter)
+  {
+    writer->file.write((char *)tile->pixels, size);
+    writer->index[index] = writer->end;
+    writer->end += size;
+  }
+}
+
+bool finishTiledImage(tiledImageWriter *writer)
+{
+  writer->file.write((char *)writer->index.data(), writer->index.size()*sizeof(uint64));
+
+  writer->header.indexOffset = writer->end;
+  writer->file.seekp(0);
+  writer->file.write((char *)&writer->header, sizeof(tiledImageHeader));
+
+  bool result = writer->file.good();
+  writer->file.close();
+
+  return(result);
+}
+
+// NOTE(ralntdir): Puts the whole image together, the missing tiles are
+// black.
+bool readTiledImage(framebuffer *fb, const char *filename)
+{
+  bool result = false;
+  std::ifstream ifs(filename, std::ifstream::in | std::ifstream::binary);
+
+  if (ifs.is_open())
+  {
+    tiledImageHeader header = {};
+    ifs.read((char *)&header, sizeof(header));
+
+    if (ifs.good() &&
+        (header.magic == TILED_IMAGE_MAGIC) &&
+        (header.version == TILED_IMAGE_VERSION) &&
+        validImageSize(header.width, header.height) &&
+        (header.tileSize > 0) && (header.tileSize <= TILED_IMAGE_MAX_TILE_SIZE) &&
+        (header.indexOffset != 0))
+    {
+      int32 count = tileCount(header.width, header.tileSize)*tileCount(header.height, header.tileSize);
+      std::vector<uint64> index(count);
+
+      ifs.seekg((std::streamoff)header.indexOffset);
+      ifs.read((char *)index.data(), count*sizeof(uint64));
+
+      *fb = allocateFramebuffer(header.width, header.height);
+      std::vector<real32> pixels(3*pixelCount(header.tileSize, header.tileSize));
+
+      for (int32 i = 0; ifs.good() && (i < count); i++)
+      {
+        if (index[i])
+        {
+          imageRegion tile = tileRegion(header.width, header.height, header.tileSize, i);
+          size_t rowSize = 3*(size_t)(tile.maxX - tile.minX);
+
+          ifs.seekg((std::streamoff)index[i]);
+          ifs.read((char *)pixels.data(), rowSize*(tile.maxY - tile.minY)*sizeof(real32));
+
+          for (int32 y = tile.minY; y < tile.maxY; y++)
+          {
+            memcpy(fb->pixels + 3*((size_t)y*fb->width + tile.minX), pixels.data() + (y - tile.minY)*rowSize,
+                   rowSize*sizeof(real32));
+          }
+        }
+      }
+
+      result = ifs.good();
+      if (!result)
+      {
+        freeFramebuffer(fb);
+      }
+    }
+
+    ifs.close();
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): A .pfm or a tiled image, whichever the file is.
+bool readHDRFile(framebuffer *fb, const char *filename)
+{
+  bool result = readPFM(fb, filename) || readTiledImage(fb, filename);
+
+  return(result);
+}
+
+struct imageDifference
+{
+  // NOTE(ralntdir): Pixels with a channel out of the tolerance, and the
+  // largest difference of a channel and where it is.
+  int32 pixels;
+  real32 maxError;
+  int32 maxX;
+  int32 maxY;
+
+  real64 rmse;
+};
+
+// NOTE(ralntdir): A channel is out of the tolerance when it differs from
+// the reference by more than absolute + relative*|reference|. Both
+// images have to be the same size. NaNs are always out.
+imageDifference compareImages(framebuffer *reference, framebuffer *image, real32 absolute, real32 relative)
+{
+  imageDifference result = {};
+  real64 sumSquared = 0.0;
+
+  for (int32 y = 0; y < reference->height; y++)
+  {
+    for (int32 x = 0; x < reference->width; x++)
+    {
+      real32 *expected = reference->pixels + 3*((size_t)y*reference->width + x);
+      real32 *actual = image->pixels + 3*((size_t)y*image->width + x);
+      bool out = false;
+
+      for (int32 c = 0; c < 3; c++)
+      {
+        real32 error = fabs(actual[c] - expected[c]);
+
+        if (!(error <= absolute + relative*fabs(expected[c])))
+        {
+          out = true;
+        }
+        if (error > result.maxError)
+        {
+          result.maxError = error;
+          result.maxX = x;
+          result.maxY = y;
+        }
+        sumSquared += (real64)error*error;
+      }
+
+      result.pixels += out ? 1 : 0;
+    }
+  }
+
+  size_t count = 3*pixelCount(reference->width, reference->height);
+  result.rmse = count ? sqrt(sumSquared/count) : 0.0;
+
+  return(result);
+}
+
+// NOTE(ralntdir): Works on the flat float array instead of on pixels,
+// and picks the operator outside the loop, so each of the loops below
+// is branch free and the compiler can vectorize it.
+void tonemap(framebuffer *fb, tonemapSettings settings, uint8 *out)
+{
+  size_t count = 3*pixelCount(fb->width, fb->height);
+  real32 *in = fb->pixels;
+  real32 scale = pow(2.0, settings.exposure);
+
+  real32 *mapped = new real32[count];
+
+  if (settings.op == tonemapClamp)
+  {
+    #pragma omp parallel for simd
+    for (size_t i = 0; i < count; i++)
+    {
+      mapped[i] = scale*in[i];
+    }
+  }
+  else if (settings.op == tonemapReinhard)
+  {
+    #pragma omp parallel for simd
+    for (size_t i = 0; i < count; i++)
+    {
+      real32 x = fmaxf(scale*in[i], 0.0f);
+      mapped[i] = x/(1.0f + x);
+    }
+  }
+  else if (settings.op == tonemapACES)
+  {
+    // NOTE(ralntdir): Krzysztof Narkowicz's fit of the ACES RRT+ODT.
+    #pragma omp parallel for simd
+    for (size_t i = 0; i < count; i++)
+    {
+      real32 x = fmaxf(scale*in[i], 0.0f);
+      mapped[i] = (x*(2.51f*x + 0.03f))/(x*(2.43f*x + 0.59f) + 0.14f);
+    }
+  }
+
+  if (settings.srgb)
+  {
+    #pragma omp parallel for simd
+    for (size_t i = 0; i < count; i++)
+    {
+      real32 x = fminf(fmaxf(mapped[i], 0.0f), 1.0f);
+      real32 encoded = 1.055f*powf(x, 1.0f/2.4f) - 0.055f;
+      mapped[i] = (x <= 0.0031308f) ? 12.92f*x : encoded;
+    }
+  }
+
+  #pragma omp parallel for simd
+  for (size_t i = 0; i < count; i++)
+  {
+    real32 x = fminf(fmaxf(mapped[i], 0.0f), 1.0f);
+    // NOTE(ralntdir): Round instead of truncating, truncation shifts
+    // everything half a step down.
+    out[i] = (uint8)(MAX_COLOR*x + 0.5f);
+  }
+
+  delete[] mapped;
+}
+
+bool writePPM(uint8 *pixels, int32 width, int32 height, const char *filename)
+{
+  bool result = false;
+  std::ofstream ofs(filename, std::ofstream::out | std::ofstream::binary);
+
+  if (ofs.is_open())
+  {
+    ofs << "P6\n";
+    ofs << "# " << filename << "\n";
+    ofs << width << " " << height << "\n";
+    ofs << MAX_COLOR << "\n";
+    ofs.write((char *)pixels, 3*pixelCount(width, height));
+
+    result = ofs.good();
+    ofs.close();
+  }
+
+  return(result);
+}
+
+#endif
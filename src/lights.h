@@ -0,0 +1,546 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+// NOTE(ralntdir): Point and directional lights reach a point from a
+// single direction. Area lights (spheres and quads) cover a range of
+// directions and are sampled, which gives soft shadows. None of them is
+// visible, they only light the scene.
+//
+// Like the point lights, the area lights don't fall off with distance
+// (unless they are given a range): the intensity is the one of the whole
+// light, and what a point gets is the average of the shading over the
+// directions the light covers from it. A small area light looks like a
+// point light at its center.
+
+enum light_type
+{
+  point,
+  directional,
+  spherical,
+  quad,
+};
+
+struct light
+{
+  // NOTE(ralntdir): The center for area lights. For directional lights
+  // it's the direction the light travels in.
+  vec3 position;
+  vec3 intensity;
+  light_type type;
+
+  // NOTE(ralntdir): Distance at which the light has faded out
+  // completely, 0 for lights that reach everything. See rangeFalloff().
+  real32 range;
+
+  // NOTE(ralntdir): Sphere lights.
+  real32 radius;
+
+  // NOTE(ralntdir): Quad lights, the two edges through the center,
+  // they have to be perpendicular.
+  vec3 edgeU;
+  vec3 edgeV;
+
+  // NOTE(ralntdir): Shadow rays per shading point, only area lights
+  // need more than one.
+  int32 samples;
+};
+
+// NOTE(ralntdir): 1 at the light, smoothly down to 0 at range (the window
+// of Karis 2013, without the inverse square, which the lights here
+// don't have).
+inline real32 rangeFalloff(real32 distance, real32 range)
+{
+  real32 result = 1.0f;
+
+  if (range > 0.0f)
+  {
+    real32 x = distance/range;
+    x = x*x;
+    x = x*x;
+    real32 w = max(1.0f - x, 0.0f);
+    result = w*w;
+  }
+
+  return(result);
+}
+
+inline bool isAreaLight(light *myLight)
+{
+  bool result = (myLight->type == spherical) || (myLight->type == quad);
+
+  return(result);
+}
+
+// NOTE(ralntdir): The light as seen from a point. Everything that
+// doesn't change between the samples of that point is computed once.
+// Area lights are sampled uniformly in the solid angle they cover, so
+// no sample is wasted on the back of a sphere or on the part of a quad
+// that is far away and looks small.
+struct lightView
+{
+  light *myLight;
+  vec3 p;
+
+  // NOTE(ralntdir): False when the light covers no directions, e.g. a
+  // quad seen exactly edge on.
+  bool visible;
+
+  // NOTE(ralntdir): Sphere lights, a cone of directions around w.
+  vec3 w;
+  vec3 u;
+  vec3 v;
+  real32 distance;
+  real32 cosThetaMax;
+
+  // NOTE(ralntdir): Quad lights, the spherical rectangle of Urena et al.
+  // 2013 ("An Area-Preserving Parametrization for Spherical
+  // Rectangles"). The quad is in a local frame (x, y, z) with the point
+  // at the origin and the quad on the plane z = z0 < 0.
+  vec3 x;
+  vec3 y;
+  vec3 z;
+  real32 x0, x1;
+  real32 y0, y1;
+  real32 z0;
+  real32 b0, b1;
+  real32 k;
+  real32 solidAngle;
+};
+
+struct lightSample
+{
+  // NOTE(ralntdir): Normalized direction to the light and how far along
+  // it the light is, shadow rays don't look beyond it.
+  vec3 L;
+  real32 distance;
+};
+
+lightView viewLight(light *myLight, vec3 p)
+{
+  lightView result = {};
+
+  result.myLight = myLight;
+  result.p = p;
+  result.visible = true;
+
+  if (myLight->type == spherical)
+  {
+    vec3 toCenter = myLight->position - p;
+    result.distance = length(toCenter);
+
+    if (result.distance > 0.0f)
+    {
+      result.w = toCenter/result.distance;
+      orthonormalBasis(result.w, &result.u, &result.v);
+
+      // NOTE(ralntdir): From inside the light it's just a point light
+      // at its center.
+      real32 sinThetaMax = myLight->radius/result.distance;
+      result.cosThetaMax = (sinThetaMax < 1.0f) ? sqrt(1.0f - sinThetaMax*sinThetaMax) : 1.0f;
+    }
+    else
+    {
+      result.visible = false;
+    }
+  }
+  else if (myLight->type == quad)
+  {
+    real32 lengthU = length(myLight->edgeU);
+    real32 lengthV = length(myLight->edgeV);
+    vec3 corner = myLight->position - 0.5f*(myLight->edgeU + myLight->edgeV);
+
+    result.x = myLight->edgeU/lengthU;
+    result.y = myLight->edgeV/lengthV;
+    result.z = crossProduct(result.x, result.y);
+
+    vec3 d = corner - p;
+    result.z0 = dotProduct(d, result.z);
+    if (result.z0 > 0.0f)
+    {
+      result.z = -result.z;
+      result.z0 = -result.z0;
+    }
+
+    result.x0 = dotProduct(d, result.x);
+    result.y0 = dotProduct(d, result.y);
+    result.x1 = result.x0 + lengthU;
+    result.y1 = result.y0 + lengthV;
+
+    // NOTE(ralntdir): Normals of the planes through the point and each
+    // edge, and the angles between them.
+    vec3 v00 = { result.x0, result.y0, result.z0 };
+    vec3 v01 = { result.x0, result.y1, result.z0 };
+    vec3 v10 = { result.x1, result.y0, result.z0 };
+    vec3 v11 = { result.x1, result.y1, result.z0 };
+
+    vec3 n0 = normalize(crossProduct(v00, v10));
+    vec3 n1 = normalize(crossProduct(v10, v11));
+    vec3 n2 = normalize(crossProduct(v11, v01));
+    vec3 n3 = normalize(crossProduct(v01, v00));
+
+    real32 g0 = acos(min(max(-dotProduct(n0, n1), -1.0f), 1.0f));
+    real32 g1 = acos(min(max(-dotProduct(n1, n2), -1.0f), 1.0f));
+    real32 g2 = acos(min(max(-dotProduct(n2, n3), -1.0f), 1.0f));
+    real32 g3 = acos(min(max(-dotProduct(n3, n0), -1.0f), 1.0f));
+
+    result.b0 = n0.z;
+    result.b1 = n2.z;
+    result.k = 2.0f*M_PI - g2 - g3;
+    result.solidAngle = g0 + g1 - result.k;
+
+    // NOTE(ralntdir): The point is on the plane of the quad (the
+    // normals above are NaN then and the comparison fails too).
+    if (!(result.solidAngle > 1e-7f))
+    {
+      result.visible = false;
+    }
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): u1 and u2 in [0, 1). Point and directional lights
+// ignore them.
+lightSample sampleLight(lightView *view, real32 u1, real32 u2)
+{
+  lightSample result = {};
+  light *myLight = view->myLight;
+
+  if (myLight->type == point)
+  {
+    vec3 toLight = myLight->position - view->p;
+    result.distance = length(toLight);
+    result.L = toLight/result.distance;
+  }
+  else if (myLight->type == directional)
+  {
+    result.L = normalize(-myLight->position);
+    result.distance = FLT_MAX;
+  }
+  else if (myLight->type == spherical)
+  {
+    real32 cosTheta = 1.0f - u1*(1.0f - view->cosThetaMax);
+    real32 sinTheta2 = max(1.0f - cosTheta*cosTheta, 0.0f);
+    real32 sinTheta = sqrt(sinTheta2);
+    real32 phi = 2.0f*M_PI*u2;
+
+    result.L = (sinTheta*cos(phi))*view->u + (sinTheta*sin(phi))*view->v + cosTheta*view->w;
+
+    // NOTE(ralntdir): Distance to the near side of the sphere.
+    real32 r = myLight->radius;
+    real32 d = view->distance;
+    real32 h = max(r*r - d*d*sinTheta2, 0.0f);
+    result.distance = d*cosTheta - sqrt(h);
+    if (result.distance <= 0.0f)
+    {
+      result.distance = d;
+    }
+  }
+  else if (myLight->type == quad)
+  {
+    // NOTE(ralntdir): u1 picks the x of the point so that the area of
+    // the spherical rectangle on its left is u1 times the whole, then
+    // u2 does the same for y along that line.
+    real32 au = u1*view->solidAngle + view->k;
+    real32 fu = (cos(au)*view->b0 - view->b1)/sin(au);
+    real32 cu = 1.0f/sqrt(fu*fu + view->b0*view->b0);
+    cu = (fu > 0.0f) ? cu : -cu;
+    cu = min(max(cu, -1.0f), 1.0f);
+
+    real32 xu = -(cu*view->z0)/sqrt(max(1.0f - cu*cu, 1e-12f));
+    xu = min(max(xu, view->x0), view->x1);
+
+    real32 d = sqrt(xu*xu + view->z0*view->z0);
+    real32 h0 = view->y0/sqrt(d*d + view->y0*view->y0);
+    real32 h1 = view->y1/sqrt(d*d + view->y1*view->y1);
+    real32 hv = h0 + u2*(h1 - h0);
+    real32 hv2 = hv*hv;
+    real32 yv = (hv2 < 1.0f - 1e-6f) ? (hv*d)/sqrt(1.0f - hv2) : view->y1;
+
+    vec3 toLight = xu*view->x + yv*view->y + view->z0*view->z;
+    result.distance = length(toLight);
+    result.L = toLight/result.distance;
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): Lights for scenes with many of them. Instead of
+// shading with every light at every hit, a few lights are picked at
+// random, each with a probability that follows how much it can add
+// at that point, and their contribution is divided by it. The tree
+// gives those probabilities without looking at every light: going
+// down from the root, each child is chosen by a bound of the light
+// that all the lights below it can give, and a whole subtree gets
+// probability 0 when it's out of range or below the surface.
+
+// NOTE(ralntdir): A leaf has count == 1 and first is the index of its
+// light. An inner node has count == 0 and its children are nodes[first]
+// and nodes[first+1].
+struct lightTreeNode
+{
+  // NOTE(ralntdir): Of the lights themselves, not of their range.
+  aabb bounds;
+  real32 power;
+  // NOTE(ralntdir): The largest range below, 0 if any of the lights
+  // reaches everything.
+  real32 range;
+
+  int32 first;
+  int32 count;
+};
+
+struct lightTree
+{
+  std::vector<lightTreeNode> nodes;
+
+  // NOTE(ralntdir): Directional lights have no position, they're always
+  // shaded.
+  std::vector<int32> unbounded;
+
+  int32 maxDepth;
+};
+
+aabb lightBounds(light *myLight)
+{
+  aabb result = emptyBounds();
+
+  if (myLight->type == point)
+  {
+    result = grow(result, myLight->position);
+  }
+  else if (myLight->type == directional)
+  {
+    result = infiniteBounds();
+  }
+  else if (myLight->type == spherical)
+  {
+    vec3 radius = { myLight->radius, myLight->radius, myLight->radius };
+    result.min = myLight->position - radius;
+    result.max = myLight->position + radius;
+  }
+  else if (myLight->type == quad)
+  {
+    vec3 halfU = 0.5f*myLight->edgeU;
+    vec3 halfV = 0.5f*myLight->edgeV;
+    result = grow(result, myLight->position - halfU - halfV);
+    result = grow(result, myLight->position + halfU - halfV);
+    result = grow(result, myLight->position - halfU + halfV);
+    result = grow(result, myLight->position + halfU + halfV);
+  }
+
+  return(result);
+}
+
+inline real32 lightPower(light *myLight)
+{
+  vec3 i = myLight->intensity;
+  real32 result = max(0.2126f*i.r + 0.7152f*i.g + 0.0722f*i.b, 0.0f);
+
+  return(result);
+}
+
+// NOTE(ralntdir): Splits in the middle of the largest axis of the
+// centers, or in half if they are all on one side, down to one light
+// per leaf.
+void subdivideLights(lightTree *tree, std::vector<light> &lights, std::vector<int32> &indices,
+                     int32 nodeIndex, int32 first, int32 count, int32 depth)
+{
+  tree->maxDepth = (depth > tree->maxDepth) ? depth : tree->maxDepth;
+
+  if (count == 1)
+  {
+    light *myLight = &lights[indices[first]];
+
+    lightTreeNode *node = &tree->nodes[nodeIndex];
+    node->bounds = lightBounds(myLight);
+    node->power = lightPower(myLight);
+    node->range = myLight->range;
+    node->first = indices[first];
+    node->count = 1;
+
+    return;
+  }
+
+  aabb centers = emptyBounds();
+  for (int32 i = first; i < first + count; i++)
+  {
+    centers = grow(centers, centroid(lightBounds(&lights[indices[i]])));
+  }
+
+  vec3 extent = centers.max - centers.min;
+  int32 axis = (extent.x > extent.y) ? 0 : 1;
+  axis = (extent.z > extent.e[axis]) ? 2 : axis;
+  real32 middle = 0.5f*(centers.min.e[axis] + centers.max.e[axis]);
+
+  int32 left = first;
+  int32 right = first + count - 1;
+  while (left <= right)
+  {
+    if (centroid(lightBounds(&lights[indices[left]])).e[axis] < middle)
+    {
+      left++;
+    }
+    else
+    {
+      int32 temp = indices[left];
+      indices[left] = indices[right];
+      indices[right] = temp;
+      right--;
+    }
+  }
+
+  int32 split = left;
+  if ((split == first) || (split == first + count))
+  {
+    split = first + count/2;
+  }
+
+  int32 childIndex = (int32)tree->nodes.size();
+  lightTreeNode child = {};
+  tree->nodes.push_back(child);
+  tree->nodes.push_back(child);
+
+  subdivideLights(tree, lights, indices, childIndex, first, split - first, depth + 1);
+  subdivideLights(tree, lights, indices, childIndex + 1, split, first + count - split, depth + 1);
+
+  lightTreeNode *a = &tree->nodes[childIndex];
+  lightTreeNode *b = &tree->nodes[childIndex + 1];
+
+  lightTreeNode *node = &tree->nodes[nodeIndex];
+  node->bounds = grow(a->bounds, b->bounds);
+  node->power = a->power + b->power;
+  node->range = ((a->range == 0.0f) || (b->range == 0.0f)) ? 0.0f : max(a->range, b->range);
+  node->first = childIndex;
+  node->count = 0;
+}
+
+void buildLightTree(lightTree *tree, std::vector<light> &lights)
+{
+  tree->nodes.clear();
+  tree->unbounded.clear();
+  tree->maxDepth = 0;
+
+  std::vector<int32> indices;
+  for (int32 i = 0; i < (int32)lights.size(); i++)
+  {
+    if (lights[i].type == directional)
+    {
+      tree->unbounded.push_back(i);
+    }
+    else
+    {
+      indices.push_back(i);
+    }
+  }
+
+  if (!indices.empty())
+  {
+    tree->nodes.reserve(2*indices.size() - 1);
+    lightTreeNode root = {};
+    tree->nodes.push_back(root);
+    subdivideLights(tree, lights, indices, 0, 0, (int32)indices.size(), 1);
+  }
+}
+
+// NOTE(ralntdir): An upper bound of what the lights of the node can add
+// at p, up to the material. 0 only when none of them can add anything.
+real32 lightImportance(lightTreeNode *node, vec3 p, vec3 N)
+{
+  real32 result = 0.0f;
+
+  // NOTE(ralntdir): The corner of the box furthest along N, if it's
+  // below the surface the whole box is.
+  vec3 corner = { (N.x > 0.0f) ? node->bounds.max.x : node->bounds.min.x,
+                  (N.y > 0.0f) ? node->bounds.max.y : node->bounds.min.y,
+                  (N.z > 0.0f) ? node->bounds.max.z : node->bounds.min.z };
+
+  if (dotProduct(corner - p, N) > 0.0f)
+  {
+    vec3 zero = { 0.0f, 0.0f, 0.0f };
+    vec3 outside = max(max(node->bounds.min - p, p - node->bounds.max), zero);
+    real32 falloff = rangeFalloff(length(outside), node->range);
+
+    // NOTE(ralntdir): The largest cosine between N and a direction to
+    // the box, taken from its bounding sphere: the angle to the center
+    // minus the angle the sphere covers.
+    real32 cosine = 1.0f;
+    vec3 toCenter = centroid(node->bounds) - p;
+    real32 distance = length(toCenter);
+    real32 radius = 0.5f*length(node->bounds.max - node->bounds.min);
+
+    if (distance > radius)
+    {
+      real32 cosTheta = dotProduct(N, toCenter)/distance;
+      real32 sinTheta = sqrt(max(1.0f - cosTheta*cosTheta, 0.0f));
+      real32 sinThetaBounds = radius/distance;
+      real32 cosThetaBounds = sqrt(1.0f - sinThetaBounds*sinThetaBounds);
+
+      if (cosTheta < cosThetaBounds)
+      {
+        cosine = max(cosTheta*cosThetaBounds + sinTheta*sinThetaBounds, 0.0f);
+      }
+    }
+
+    result = node->power*falloff*cosine;
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): Picks one light of the tree for a point with normal N
+// and returns its index and the probability it was picked with, or -1
+// if no light can reach the point. u in [0, 1) is reused for every
+// level, rescaled to the part of it the choice left.
+int32 pickLight(lightTree *tree, vec3 p, vec3 N, real32 u, real32 *probability)
+{
+  int32 result = -1;
+  *probability = 0.0f;
+
+  if (tree->nodes.empty())
+  {
+    return(result);
+  }
+
+  real32 pdf = 1.0f;
+  lightTreeNode *node = &tree->nodes[0];
+
+  while (node->count == 0)
+  {
+    lightTreeNode *a = &tree->nodes[node->first];
+    lightTreeNode *b = &tree->nodes[node->first + 1];
+
+    real32 importanceA = lightImportance(a, p, N);
+    real32 importanceB = lightImportance(b, p, N);
+    real32 total = importanceA + importanceB;
+
+    if (total <= 0.0f)
+    {
+      return(result);
+    }
+
+    real32 pA = importanceA/total;
+    if (u < pA)
+    {
+      u = min(u/pA, 0.99999994f);
+      pdf *= pA;
+      node = a;
+    }
+    else
+    {
+      u = min((u - pA)/(1.0f - pA), 0.99999994f);
+      pdf *= 1.0f - pA;
+      node = b;
+    }
+  }
+
+  if (lightImportance(node, p, N) > 0.0f)
+  {
+    result = node->first;
+    *probability = pdf;
+  }
+
+  return(result);
+}
+
+#endif
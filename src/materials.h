@@ -0,0 +1,202 @@
+#ifndef MATERIALS_H
+#define MATERIALS_H
+
+// NOTE(ralntdir): Direct light is shaded with Phong (ka, kd, ks, alpha).
+// On top of that a material can send one more ray at every hit:
+//
+// - Mirrors and glossy surfaces reflect, scaled by kr. With a roughness
+//   the reflection spreads around the mirror direction.
+// - Dielectrics (glass, water) have a kt and refract. The Fresnel term
+//   decides how much of the light is reflected and how much goes
+//   through, kr is ignored for them.
+//
+// Only one ray is traced per hit, picked with the probability of each
+// lobe: the reflection or the refraction of a dielectric, by its Fresnel
+// term, and the direction of a rough one, by the shape of the lobe. What
+// a lobe weighs then cancels out with the probability of picking it, so
+// a sample is weighted by kr or kt alone and glass costs the same rays
+// as a mirror.
+
+struct materialParameters
+{
+  vec3 ka;
+  vec3 kd;
+  vec3 ks;
+
+  vec3 kr;
+  // NOTE(ralntdir): Reflections off this material are only traced up to
+  // this bounce of a path, 0 leaves it to MAX_DEPTH.
+  int32 bounces;
+
+  // NOTE(ralntdir): Tint of the light that goes through a dielectric, 0
+  // for opaque materials, and the index of refraction of its inside.
+  vec3 kt;
+  real32 ior;
+
+  // NOTE(ralntdir): 0 is a perfect mirror (or clear glass), 1 spreads
+  // the reflection (or the refraction) over the whole hemisphere.
+  real32 roughness;
+
+  real32 alpha;
+};
+
+#define DEFAULT_IOR 1.5f
+
+inline bool isDielectric(materialParameters *material)
+{
+  bool result = (material->kt.x > 0.0f) || (material->kt.y > 0.0f) || (material->kt.z > 0.0f);
+
+  return(result);
+}
+
+// NOTE(ralntdir): If a hit on it sends a reflection or a refraction ray.
+inline bool scattersLight(materialParameters *material)
+{
+  bool result = isDielectric(material) ||
+                (material->kr.x > 0.0f) || (material->kr.y > 0.0f) || (material->kr.z > 0.0f);
+
+  return(result);
+}
+
+// NOTE(ralntdir): Of direction about N, both normalized.
+inline vec3 reflect(vec3 direction, vec3 N)
+{
+  vec3 result = normalize(2*dotProduct(-direction, N)*N + direction);
+
+  return(result);
+}
+
+// NOTE(ralntdir): N is on the side direction comes from, eta is the
+// index of refraction of that side over the one of the other side.
+// Returns false for total internal reflection.
+bool refract(vec3 direction, vec3 N, real32 eta, vec3 *refracted)
+{
+  real32 cosI = -dotProduct(direction, N);
+  real32 sin2T = eta*eta*(1.0f - cosI*cosI);
+  bool result = (sin2T < 1.0f);
+
+  if (result)
+  {
+    real32 cosT = sqrtf(1.0f - sin2T);
+    *refracted = normalize(eta*direction + (eta*cosI - cosT)*N);
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): The fraction of the light that a dielectric reflects,
+// Schlick's approximation of the Fresnel equations. The cosine is the
+// one on the side with the lower index, so it also works from inside.
+real32 fresnelReflectance(real32 cosI, real32 eta)
+{
+  real32 result = 1.0f;
+  real32 cosine = cosI;
+
+  if (eta > 1.0f)
+  {
+    real32 sin2T = eta*eta*(1.0f - cosI*cosI);
+    cosine = (sin2T < 1.0f) ? sqrtf(1.0f - sin2T) : -1.0f;
+  }
+
+  if (cosine >= 0.0f)
+  {
+    real32 r0 = (1.0f - eta)/(1.0f + eta);
+    r0 = r0*r0;
+    real32 c = 1.0f - cosine;
+    result = r0 + (1.0f - r0)*c*c*c*c*c;
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): A direction around axis with a density proportional to
+// cos^exponent of the angle to it, the Phong lobe. Exponent 0 is uniform
+// over the hemisphere.
+vec3 sampleLobe(vec3 axis, real32 exponent, real32 u1, real32 u2)
+{
+  real32 cosTheta = powf(u1, 1.0f/(exponent + 1.0f));
+  real32 sinTheta = sqrtf(max(1.0f - cosTheta*cosTheta, 0.0f));
+  real32 phi = 2.0f*M_PI*u2;
+
+  vec3 u = {};
+  vec3 v = {};
+  orthonormalBasis(axis, &u, &v);
+
+  vec3 result = (sinTheta*cosf(phi))*u + (sinTheta*sinf(phi))*v + cosTheta*axis;
+
+  return(result);
+}
+
+// NOTE(ralntdir): The exponent of the Phong lobe that is about as wide as
+// the Beckmann distribution of this roughness.
+inline real32 lobeExponent(real32 roughness)
+{
+  real32 result = 2.0f/(roughness*roughness) - 2.0f;
+
+  return(result);
+}
+
+// NOTE(ralntdir): The ray a hit sends on, and what the light that comes
+// back along it is scaled by. A weight of 0 sends nothing.
+struct scatterSample
+{
+  vec3 direction;
+  vec3 weight;
+  bool refracted;
+};
+
+// NOTE(ralntdir): direction is the one of the ray that hit, N the normal
+// of the surface, pointing out of it. Mirrors don't draw any random
+// numbers.
+scatterSample sampleScattering(materialParameters *material, vec3 direction, vec3 N, randomSeries *series)
+{
+  scatterSample result = {};
+  bool dielectric = isDielectric(material);
+
+  if (scattersLight(material))
+  {
+    // NOTE(ralntdir): The side of the surface the ray comes from.
+    bool entering = (dotProduct(direction, N) < 0.0f);
+    vec3 facing = entering ? N : -N;
+
+    result.direction = reflect(direction, facing);
+    result.weight = material->kr;
+
+    if (dielectric)
+    {
+      real32 eta = entering ? 1.0f/material->ior : material->ior;
+      real32 reflectance = fresnelReflectance(-dotProduct(direction, facing), eta);
+
+      vec3 refracted = {};
+      if ((randomUnilateral(series) >= reflectance) && refract(direction, facing, eta, &refracted))
+      {
+        result.direction = refracted;
+        result.weight = material->kt;
+        result.refracted = true;
+      }
+      else
+      {
+        result.weight = { 1.0f, 1.0f, 1.0f };
+      }
+    }
+
+    // NOTE(ralntdir): A direction of the lobe that ends up on the wrong
+    // side of the surface is light the lobe loses, it isn't traced.
+    if (material->roughness > 0.0f)
+    {
+      real32 u1 = randomUnilateral(series);
+      real32 u2 = randomUnilateral(series);
+      result.direction = sampleLobe(result.direction, lobeExponent(material->roughness), u1, u2);
+
+      real32 side = dotProduct(result.direction, facing);
+      if (result.refracted ? (side >= 0.0f) : (side <= 0.0f))
+      {
+        result.weight = {};
+      }
+    }
+  }
+
+  return(result);
+}
+
+#endif
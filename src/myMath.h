@@ -192,4 +192,418 @@ real32 max(real32 a, real32 b)
   return(result);
 }
 
+real32 min(real32 a, real32 b)
+{
+  real32 result = b;
+
+  if (a < b)
+  {
+    result = a;
+  }
+
+  return(result);
+}
+
+vec3 min(vec3 a, vec3 b)
+{
+  vec3 result = { min(a.x, b.x), min(a.y, b.y), min(a.z, b.z) };
+
+  return(result);
+}
+
+vec3 max(vec3 a, vec3 b)
+{
+  vec3 result = { max(a.x, b.x), max(a.y, b.y), max(a.z, b.z) };
+
+  return(result);
+}
+
+// NOTE(ralntdir): Axis aligned bounding box. An empty one has
+// min > max, so growing it with the first point just works.
+struct aabb
+{
+  vec3 min;
+  vec3 max;
+};
+
+aabb emptyBounds()
+{
+  aabb result = {};
+
+  result.min = { FLT_MAX, FLT_MAX, FLT_MAX };
+  result.max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+  return(result);
+}
+
+aabb infiniteBounds()
+{
+  aabb result = {};
+
+  result.min = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+  result.max = { FLT_MAX, FLT_MAX, FLT_MAX };
+
+  return(result);
+}
+
+aabb grow(aabb box, vec3 point)
+{
+  aabb result = {};
+
+  result.min = min(box.min, point);
+  result.max = max(box.max, point);
+
+  return(result);
+}
+
+aabb grow(aabb a, aabb b)
+{
+  aabb result = {};
+
+  result.min = min(a.min, b.min);
+  result.max = max(a.max, b.max);
+
+  return(result);
+}
+
+bool isInfinite(aabb box)
+{
+  bool result = (box.min.x == -FLT_MAX) || (box.min.y == -FLT_MAX) || (box.min.z == -FLT_MAX) ||
+                (box.max.x == FLT_MAX) || (box.max.y == FLT_MAX) || (box.max.z == FLT_MAX);
+
+  return(result);
+}
+
+bool isEmpty(aabb box)
+{
+  bool result = (box.min.x > box.max.x) || (box.min.y > box.max.y) || (box.min.z > box.max.z);
+
+  return(result);
+}
+
+aabb intersect(aabb a, aabb b)
+{
+  aabb result = {};
+
+  result.min = max(a.min, b.min);
+  result.max = min(a.max, b.max);
+
+  return(result);
+}
+
+// NOTE(ralntdir): Bit 0 picks the x of max, bit 1 the y and bit 2 the z.
+inline vec3 boxCorner(aabb box, int32 corner)
+{
+  vec3 result = { (corner & 1) ? box.max.x : box.min.x,
+                  (corner & 2) ? box.max.y : box.min.y,
+                  (corner & 4) ? box.max.z : box.min.z };
+
+  return(result);
+}
+
+// NOTE(ralntdir): The shortest and the longest distance between a point
+// of a and a point of b, the shortest is 0 when they overlap.
+real32 minDistance(aabb a, aabb b)
+{
+  vec3 zero = {};
+  vec3 gap = max(max(a.min - b.max, b.min - a.max), zero);
+  real32 result = length(gap);
+
+  return(result);
+}
+
+real32 maxDistance(aabb a, aabb b)
+{
+  vec3 span = max(a.max - b.min, b.max - a.min);
+  real32 result = length(span);
+
+  return(result);
+}
+
+// NOTE(ralntdir): Slab test. Entry distance of the ray into the box,
+// FLT_MAX if it misses it or the box starts beyond tMax. invDirection
+// is 1/direction per axis, a 0 component gives +-inf and the
+// comparisons still work out.
+inline real32 boundsDistance(aabb box, vec3 origin, vec3 invDirection, real32 tMax)
+{
+  real32 tNear = 0.0;
+  real32 tFar = tMax;
+
+  for (int32 axis = 0; axis < 3; axis++)
+  {
+    real32 t0 = (box.min.e[axis] - origin.e[axis])*invDirection.e[axis];
+    real32 t1 = (box.max.e[axis] - origin.e[axis])*invDirection.e[axis];
+
+    tNear = max(tNear, min(t0, t1));
+    tFar = min(tFar, max(t0, t1));
+  }
+
+  real32 result = (tNear <= tFar) ? tNear : FLT_MAX;
+
+  return(result);
+}
+
+// NOTE(ralntdir): Only affine transforms are used, so this is a 3x4
+// matrix stored as 4x4 with an implicit (0, 0, 0, 1) last row.
+struct mat4
+{
+  real32 e[4][4];
+};
+
+mat4 identity()
+{
+  mat4 result = {};
+
+  result.e[0][0] = 1.0;
+  result.e[1][1] = 1.0;
+  result.e[2][2] = 1.0;
+  result.e[3][3] = 1.0;
+
+  return(result);
+}
+
+mat4 operator*(mat4 a, mat4 b)
+{
+  mat4 result = {};
+
+  for (int32 row = 0; row < 4; row++)
+  {
+    for (int32 column = 0; column < 4; column++)
+    {
+      for (int32 k = 0; k < 4; k++)
+      {
+        result.e[row][column] += a.e[row][k]*b.e[k][column];
+      }
+    }
+  }
+
+  return(result);
+}
+
+mat4 translation(vec3 offset)
+{
+  mat4 result = identity();
+
+  result.e[0][3] = offset.x;
+  result.e[1][3] = offset.y;
+  result.e[2][3] = offset.z;
+
+  return(result);
+}
+
+mat4 scaling(vec3 factors)
+{
+  mat4 result = identity();
+
+  result.e[0][0] = factors.x;
+  result.e[1][1] = factors.y;
+  result.e[2][2] = factors.z;
+
+  return(result);
+}
+
+// NOTE(ralntdir): Rodrigues' rotation formula, angle in degrees.
+mat4 rotation(vec3 axis, real32 degrees)
+{
+  mat4 result = identity();
+
+  vec3 u = normalize(axis);
+  real32 radians = degrees*M_PI/180.0;
+  real32 c = cos(radians);
+  real32 s = sin(radians);
+  real32 k = 1.0 - c;
+
+  result.e[0][0] = c + u.x*u.x*k;
+  result.e[0][1] = u.x*u.y*k - u.z*s;
+  result.e[0][2] = u.x*u.z*k + u.y*s;
+  result.e[1][0] = u.y*u.x*k + u.z*s;
+  result.e[1][1] = c + u.y*u.y*k;
+  result.e[1][2] = u.y*u.z*k - u.x*s;
+  result.e[2][0] = u.z*u.x*k - u.y*s;
+  result.e[2][1] = u.z*u.y*k + u.x*s;
+  result.e[2][2] = c + u.z*u.z*k;
+
+  return(result);
+}
+
+// NOTE(ralntdir): Inverse of an affine transform, the 3x3 part is
+// inverted with its adjugate and the translation is undone after it.
+mat4 affineInverse(mat4 m)
+{
+  mat4 result = identity();
+
+  vec3 c0 = { m.e[0][0], m.e[1][0], m.e[2][0] };
+  vec3 c1 = { m.e[0][1], m.e[1][1], m.e[2][1] };
+  vec3 c2 = { m.e[0][2], m.e[1][2], m.e[2][2] };
+
+  // NOTE(ralntdir): The rows of the inverse are the cross products of
+  // the columns divided by the determinant.
+  vec3 r0 = crossProduct(c1, c2);
+  vec3 r1 = crossProduct(c2, c0);
+  vec3 r2 = crossProduct(c0, c1);
+  real32 invDet = 1.0/dotProduct(c0, r0);
+
+  r0 = invDet*r0;
+  r1 = invDet*r1;
+  r2 = invDet*r2;
+
+  vec3 t = { m.e[0][3], m.e[1][3], m.e[2][3] };
+
+  result.e[0][0] = r0.x; result.e[0][1] = r0.y; result.e[0][2] = r0.z;
+  result.e[1][0] = r1.x; result.e[1][1] = r1.y; result.e[1][2] = r1.z;
+  result.e[2][0] = r2.x; result.e[2][1] = r2.y; result.e[2][2] = r2.z;
+  result.e[0][3] = -dotProduct(r0, t);
+  result.e[1][3] = -dotProduct(r1, t);
+  result.e[2][3] = -dotProduct(r2, t);
+
+  return(result);
+}
+
+inline vec3 transformPoint(mat4 m, vec3 p)
+{
+  vec3 result = {};
+
+  result.x = m.e[0][0]*p.x + m.e[0][1]*p.y + m.e[0][2]*p.z + m.e[0][3];
+  result.y = m.e[1][0]*p.x + m.e[1][1]*p.y + m.e[1][2]*p.z + m.e[1][3];
+  result.z = m.e[2][0]*p.x + m.e[2][1]*p.y + m.e[2][2]*p.z + m.e[2][3];
+
+  return(result);
+}
+
+inline vec3 transformVector(mat4 m, vec3 v)
+{
+  vec3 result = {};
+
+  result.x = m.e[0][0]*v.x + m.e[0][1]*v.y + m.e[0][2]*v.z;
+  result.y = m.e[1][0]*v.x + m.e[1][1]*v.y + m.e[1][2]*v.z;
+  result.z = m.e[2][0]*v.x + m.e[2][1]*v.y + m.e[2][2]*v.z;
+
+  return(result);
+}
+
+// NOTE(ralntdir): Normals go with the transpose of the inverse, so
+// this takes the inverse (worldToObject) and reads it transposed.
+inline vec3 transformNormal(mat4 inverse, vec3 n)
+{
+  vec3 result = {};
+
+  result.x = inverse.e[0][0]*n.x + inverse.e[1][0]*n.y + inverse.e[2][0]*n.z;
+  result.y = inverse.e[0][1]*n.x + inverse.e[1][1]*n.y + inverse.e[2][1]*n.z;
+  result.z = inverse.e[0][2]*n.x + inverse.e[1][2]*n.y + inverse.e[2][2]*n.z;
+
+  result = normalize(result);
+
+  return(result);
+}
+
+aabb transformBounds(mat4 m, aabb box)
+{
+  aabb result = emptyBounds();
+
+  if (isInfinite(box))
+  {
+    result = infiniteBounds();
+  }
+  else
+  {
+    for (int32 corner = 0; corner < 8; corner++)
+    {
+      vec3 p = { (corner & 1) ? box.max.x : box.min.x,
+                 (corner & 2) ? box.max.y : box.min.y,
+                 (corner & 4) ? box.max.z : box.min.z };
+      result = grow(result, transformPoint(m, p));
+    }
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): Two vectors that make an orthonormal basis with n, which
+// has to be normalized (Duff et al. 2017, no branches and no sqrt).
+void orthonormalBasis(vec3 n, vec3 *b1, vec3 *b2)
+{
+  real32 sign = copysignf(1.0f, n.z);
+  real32 a = -1.0f/(sign + n.z);
+  real32 b = n.x*n.y*a;
+
+  vec3 first = { 1.0f + sign*n.x*n.x*a, sign*b, -sign*n.x };
+  vec3 second = { b, sign + n.y*n.y*a, -n.y };
+
+  *b1 = first;
+  *b2 = second;
+}
+
+// NOTE(ralntdir): Moves a point of a surface off it along n, the side the
+// new ray leaves from, so the ray doesn't hit the same surface again
+// (Wachter and Binder, "A Fast and Robust Method for Avoiding
+// Self-Intersection"). The offset is a number of ulps of each coordinate,
+// so it grows with the coordinates like the error of the hit point does.
+// Close to the origin ulps are tiny and a fixed distance is used.
+inline real32 offsetCoordinate(real32 p, real32 n)
+{
+  int32 offset = (int32)(256.0f*n);
+
+  int32 bits;
+  memcpy(&bits, &p, sizeof(bits));
+  bits += (p < 0.0f) ? -offset : offset;
+
+  real32 moved;
+  memcpy(&moved, &bits, sizeof(moved));
+
+  real32 result = (fabsf(p) < 1.0f/32.0f) ? p + n*(1.0f/65536.0f) : moved;
+
+  return(result);
+}
+
+inline vec3 offsetRayOrigin(vec3 p, vec3 n)
+{
+  vec3 result = {};
+
+  result.x = offsetCoordinate(p.x, n.x);
+  result.y = offsetCoordinate(p.y, n.y);
+  result.z = offsetCoordinate(p.z, n.z);
+
+  return(result);
+}
+
+// NOTE(ralntdir): xorshift64* (Vigna). The whole state is one uint64,
+// so every pixel can have its own series and it can be saved to disk
+// and restored exactly.
+struct randomSeries
+{
+  uint64 state;
+};
+
+// NOTE(ralntdir): splitmix64 of the seed, so that consecutive seeds
+// (pixel indices) start far apart and the state is never 0.
+randomSeries seedSeries(uint64 seed)
+{
+  randomSeries result = {};
+
+  uint64 z = seed + 0x9E3779B97F4A7C15ull;
+  z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27))*0x94D049BB133111EBull;
+  z = z ^ (z >> 31);
+
+  result.state = z ? z : 0x9E3779B97F4A7C15ull;
+
+  return(result);
+}
+
+// NOTE(ralntdir): Between [0, 1)
+inline real32 randomUnilateral(randomSeries *series)
+{
+  uint64 x = series->state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  series->state = x;
+
+  // NOTE(ralntdir): The top 24 bits, that's all a real32 can hold.
+  uint32 bits = (uint32)((x*0x2545F4914F6CDD1Dull) >> 40);
+  real32 result = bits*(1.0f/16777216.0f);
+
+  return(result);
+}
+
 #endif
@@ -0,0 +1,390 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+// NOTE(ralntdir): Tokens of a scene file, with the line and column they
+// start at so errors can point at them. Tokens are separated by
+// whitespace, and a # starts a comment that runs to the end of the line.
+//
+// Errors (a number that isn't one, a missing keyword, the file ending in
+// the middle of something) stop the reading, everything after them
+// would be read out of place. Warnings are for things that can be
+// skipped (an unknown keyword, a triangle without area), in strict mode
+// they are errors too.
+
+struct sceneReader
+{
+  const char *fileName;
+
+  // NOTE(ralntdir): The whole file, it isn't owned by the reader. The
+  // readers of the chunks of a big file share it.
+  const char *text;
+  size_t size;
+  size_t position;
+
+  // NOTE(ralntdir): Of the next character, and of the last token for
+  // the messages. Both start at 1.
+  int32 line;
+  int32 column;
+  int32 tokenLine;
+  int32 tokenColumn;
+
+  // NOTE(ralntdir): Where the last token is in text.
+  size_t tokenStart;
+  size_t tokenLength;
+
+  bool strict;
+  bool failed;
+  int32 warnings;
+
+  // NOTE(ralntdir): If set the messages are kept here instead of
+  // printed, for readers whose work may be thrown away.
+  std::string *messages;
+};
+
+// NOTE(ralntdir): The whole file at once, with a single read.
+bool readTextFile(const char *fileName, std::string *text)
+{
+  bool result = false;
+  std::ifstream ifs(fileName, std::ifstream::in | std::ifstream::binary);
+
+  if (ifs.is_open())
+  {
+    ifs.seekg(0, std::ifstream::end);
+    std::streamoff size = ifs.tellg();
+    ifs.seekg(0, std::ifstream::beg);
+
+    if (size >= 0)
+    {
+      text->resize((size_t)size);
+      ifs.read(&(*text)[0], size);
+      result = !ifs.fail();
+    }
+    ifs.close();
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): text has to outlive the reader.
+void startSceneReader(sceneReader *reader, const char *fileName, const std::string &text, bool strict)
+{
+  *reader = {};
+  reader->fileName = fileName;
+  reader->text = text.c_str();
+  reader->size = text.size();
+  reader->line = 1;
+  reader->column = 1;
+  reader->tokenLine = 1;
+  reader->tokenColumn = 1;
+  reader->strict = strict;
+}
+
+void printMessage(sceneReader *reader, const char *kind, const std::string &message)
+{
+  std::string text = std::string(reader->fileName) + ":" + std::to_string(reader->tokenLine) + ":" +
+                     std::to_string(reader->tokenColumn) + ": " + kind + ": " + message + "\n";
+
+  if (reader->messages)
+  {
+    *reader->messages += text;
+  }
+  else
+  {
+    std::cout << text;
+  }
+}
+
+void parseError(sceneReader *reader, const std::string &message)
+{
+  if (!reader->failed)
+  {
+    printMessage(reader, "error", message);
+  }
+  reader->failed = true;
+}
+
+void parseWarning(sceneReader *reader, const std::string &message)
+{
+  if (reader->strict)
+  {
+    parseError(reader, message);
+  }
+  else if (!reader->failed)
+  {
+    printMessage(reader, "warning", message);
+    reader->warnings++;
+  }
+}
+
+// NOTE(ralntdir): The whitespace of isspace() in the C locale, without
+// a call into the C library for every character.
+inline bool isSpace(char c)
+{
+  bool result = (c == ' ') || ((c >= '\t') && (c <= '\r'));
+
+  return(result);
+}
+
+// NOTE(ralntdir): Up to the next token, or to the end of the file.
+void skipSpace(sceneReader *reader)
+{
+  const char *text = reader->text;
+  size_t size = reader->size;
+  size_t position = reader->position;
+  int32 line = reader->line;
+  int32 column = reader->column;
+
+  while (position < size)
+  {
+    char c = text[position];
+
+    if (c == '\n')
+    {
+      line++;
+      column = 1;
+      position++;
+    }
+    else if (isSpace(c))
+    {
+      column++;
+      position++;
+    }
+    else if (c == '#')
+    {
+      while ((position < size) && (text[position] != '\n'))
+      {
+        column++;
+        position++;
+      }
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  reader->position = position;
+  reader->line = line;
+  reader->column = column;
+}
+
+// NOTE(ralntdir): Leaves the token in tokenStart and tokenLength without
+// copying it. Returns false at the end of the file, or after an error,
+// so every loop over the tokens stops there.
+bool scanToken(sceneReader *reader)
+{
+  bool result = false;
+
+  if (!reader->failed)
+  {
+    skipSpace(reader);
+    result = (reader->position < reader->size);
+  }
+
+  reader->tokenLine = reader->line;
+  reader->tokenColumn = reader->column;
+  reader->tokenStart = reader->position;
+  reader->tokenLength = 0;
+
+  if (result)
+  {
+    const char *text = reader->text;
+    size_t size = reader->size;
+    size_t position = reader->position;
+
+    // NOTE(ralntdir): No newlines inside a token, only the column moves.
+    while ((position < size) && !isSpace(text[position]))
+    {
+      position++;
+    }
+
+    reader->position = position;
+    reader->tokenLength = position - reader->tokenStart;
+    reader->column += (int32)reader->tokenLength;
+  }
+
+  return(result);
+}
+
+std::string tokenText(sceneReader *reader)
+{
+  std::string result(reader->text + reader->tokenStart, reader->tokenLength);
+
+  return(result);
+}
+
+bool isToken(sceneReader *reader, const char *keyword)
+{
+  size_t length = strlen(keyword);
+  bool result = (reader->tokenLength == length) &&
+                (memcmp(reader->text + reader->tokenStart, keyword, length) == 0);
+
+  return(result);
+}
+
+bool nextToken(sceneReader *reader, std::string *token)
+{
+  bool result = scanToken(reader);
+
+  if (result)
+  {
+    token->assign(reader->text + reader->tokenStart, reader->tokenLength);
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): what says what was expected, for the message.
+bool expectToken(sceneReader *reader, std::string *token, const char *what)
+{
+  bool result = nextToken(reader, token);
+
+  if (!result)
+  {
+    parseError(reader, std::string("expected ") + what + ", found the end of the file");
+  }
+
+  return(result);
+}
+
+bool expectKeyword(sceneReader *reader, const char *keyword)
+{
+  bool result = scanToken(reader);
+
+  if (!result)
+  {
+    parseError(reader, std::string("expected '") + keyword + "', found the end of the file");
+  }
+  else if (!isToken(reader, keyword))
+  {
+    parseError(reader, std::string("expected '") + keyword + "', found '" + tokenText(reader) + "'");
+    result = false;
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): Numbers like the ones in the scene files, up to 7
+// digits and no exponent, are exact as floats, and so is a power of
+// ten up to 10^10. A single division rounds them once, to the same float
+// strtof() gives (Clinger's fast path). Returns false for anything else.
+bool parseShortDecimal(const char *text, size_t length, real32 *value)
+{
+  static const real32 powersOfTen[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                        1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+  size_t i = 0;
+  bool negative = (length > 0) && (text[0] == '-');
+  if (negative)
+  {
+    i++;
+  }
+
+  uint32 mantissa = 0;
+  int32 digits = 0;
+  int32 decimals = 0;
+  bool point = false;
+  bool result = true;
+
+  for (; result && (i < length); i++)
+  {
+    char c = text[i];
+
+    if ((c >= '0') && (c <= '9'))
+    {
+      mantissa = 10*mantissa + (c - '0');
+      digits++;
+      decimals += point ? 1 : 0;
+      result = (mantissa <= (1u << 24)) && (decimals <= 10);
+    }
+    else if ((c == '.') && !point)
+    {
+      point = true;
+    }
+    else
+    {
+      result = false;
+    }
+  }
+
+  if (result && (digits > 0))
+  {
+    real32 number = (real32)mantissa/powersOfTen[decimals];
+    *value = negative ? -number : number;
+  }
+  else
+  {
+    result = false;
+  }
+
+  return(result);
+}
+
+bool readNumber(sceneReader *reader, real32 *value)
+{
+  bool result = scanToken(reader);
+
+  if (!result)
+  {
+    parseError(reader, "expected a number, found the end of the file");
+  }
+  else
+  {
+    const char *token = reader->text + reader->tokenStart;
+
+    if (!parseShortDecimal(token, reader->tokenLength, value))
+    {
+      // NOTE(ralntdir): The token ends at a space or at the end of the
+      // text, so strtof() doesn't read past it.
+      char *end = 0;
+      *value = strtof(token, &end);
+
+      result = (end == token + reader->tokenLength) && isfinite(*value);
+      if (!result)
+      {
+        parseError(reader, "expected a number, found '" + tokenText(reader) + "'");
+      }
+    }
+  }
+
+  return(result);
+}
+
+bool readInteger(sceneReader *reader, int32 *value)
+{
+  bool result = scanToken(reader);
+
+  if (!result)
+  {
+    parseError(reader, "expected an integer, found the end of the file");
+  }
+  else
+  {
+    const char *token = reader->text + reader->tokenStart;
+    char *end = 0;
+    long number = strtol(token, &end, 10);
+
+    result = (end == token + reader->tokenLength) && (number >= INT32_MIN) && (number <= INT32_MAX);
+    if (result)
+    {
+      *value = (int32)number;
+    }
+    else
+    {
+      parseError(reader, "expected an integer, found '" + tokenText(reader) + "'");
+    }
+  }
+
+  return(result);
+}
+
+bool readVector(sceneReader *reader, vec3 *vector)
+{
+  bool result = readNumber(reader, &vector->x) &&
+                readNumber(reader, &vector->y) &&
+                readNumber(reader, &vector->z);
+
+  return(result);
+}
+
+#endif
@@ -0,0 +1,262 @@
+#!/bin/bash
+
+# Renders every scene in ../scenes with each backend, with a fixed seed
+# and without a window, and compares the images with the golden ones.
+# The exit status is 1 if an image is out of the tolerance. With
+# --timing it also renders every scene again, larger, and prints how
+# long each backend took.
+#
+# The golden images are in scenes/golden, small and with few samples so
+# a run takes seconds. Render them again with --update (single-thread
+# backend) only when a change is meant to change the images, and check
+# the new ones before committing them.
+#
+# Backends:
+#   single-thread  one thread
+#   threaded       all the threads
+#   tiled          all the threads, in tiles into a tiled file
+#                  (--tiled-output), compared after reading it back the
+#                  way --from-hdr does
+
+# NOTE(ralntdir): Relative to the script, so it runs from anywhere.
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+PROGRAM="$ROOT/build/program"
+SCENES="$ROOT/scenes"
+GOLDEN="$ROOT/scenes/golden"
+OUTPUT="$ROOT/build/regress"
+BACKENDS="single-thread threaded tiled"
+# NOTE(ralntdir): Wider and taller than a tile of --tiled-output, so the
+# tiled backend writes more than one, and some of them partly.
+WIDTH=72
+HEIGHT=72
+SPP=4
+TIMING=0
+TIMING_WIDTH=256
+TIMING_HEIGHT=256
+TIMING_SPP=16
+SEED=1
+ABSOLUTE=1e-4
+RELATIVE=1e-3
+UPDATE=0
+
+usage()
+{
+  echo "Usage: ./regress.sh [options] [scene names]"
+  echo "Options:"
+  echo "  --update              render the golden images again (single-thread backend)"
+  echo "  --backends \"a b\"      backends to run (default \"$BACKENDS\")"
+  echo "  --size w h            of the images, the golden ones have to match (default $WIDTH $HEIGHT)"
+  echo "  --spp n               samples per pixel (default $SPP)"
+  echo "  --tolerance abs rel   per channel, see --tolerance of the program (default $ABSOLUTE $RELATIVE)"
+  echo "  --timing              time every backend on larger renders"
+  echo "                        (--size $TIMING_WIDTH $TIMING_HEIGHT --spp $TIMING_SPP), the speedup is over the first"
+  echo "  --program path        renderer to test (default $PROGRAM)"
+  echo "  --golden dir          where the golden images are (default $GOLDEN)"
+}
+
+backendOptions()
+{
+  case "$1" in
+    single-thread) echo "--threads 1" ;;
+    threaded) echo "" ;;
+    tiled) echo "" ;;
+    *) return 1 ;;
+  esac
+}
+
+# NOTE(ralntdir): What the image of a backend is written with, and the
+# extension of the file.
+outputOption()
+{
+  case "$1" in
+    tiled) echo "--tiled-output" ;;
+    *) echo "--hdr-output" ;;
+  esac
+}
+
+imageExtension()
+{
+  case "$1" in
+    tiled) echo "rtil" ;;
+    *) echo "pfm" ;;
+  esac
+}
+
+NAMES=()
+while [ $# -gt 0 ]
+do
+  case "$1" in
+    --update) UPDATE=1 ;;
+    --backends) BACKENDS="$2"; shift ;;
+    --size) WIDTH="$2"; HEIGHT="$3"; shift 2 ;;
+    --spp) SPP="$2"; shift ;;
+    --tolerance) ABSOLUTE="$2"; RELATIVE="$3"; shift 2 ;;
+    --timing) TIMING=1 ;;
+    --program) PROGRAM="$2"; shift ;;
+    --golden) GOLDEN="$2"; shift ;;
+    -h|--help) usage; exit 0 ;;
+    -*) usage; exit 1 ;;
+    *) NAMES+=("$1") ;;
+  esac
+  shift
+done
+
+for BACKEND in $BACKENDS
+do
+  if ! backendOptions "$BACKEND" > /dev/null
+  then
+    echo "Unknown backend $BACKEND"
+    exit 1
+  fi
+done
+
+if [ ! -x "$PROGRAM" ]
+then
+  echo "There is no $PROGRAM, build it with build.sh rt.cpp in $ROOT/src"
+  exit 1
+fi
+
+# NOTE(ralntdir): Absolute, the renders run inside the output directory
+# so the .ppm and the checkpoints they leave go there too.
+mkdir -p "$GOLDEN" "$OUTPUT"
+PROGRAM="$(cd "$(dirname "$PROGRAM")" && pwd)/$(basename "$PROGRAM")"
+SCENES="$(cd "$SCENES" && pwd)"
+GOLDEN="$(cd "$GOLDEN" && pwd)"
+OUTPUT="$(cd "$OUTPUT" && pwd)"
+
+if [ ${#NAMES[@]} -eq 0 ]
+then
+  for FILE in "$SCENES"/*.txt
+  do
+    NAMES+=("$(basename "$FILE" .txt)")
+  done
+fi
+
+# NOTE(ralntdir): Renders scene $1 with backend $2 into $3, $4 x $5
+# pixels with $6 samples, and prints the seconds it took. A tiled image
+# is read back with --from-hdr too, which fails if it can't be read.
+render()
+{
+  local START END STATUS
+  START=$(date +%s.%N)
+  (cd "$OUTPUT" && "$PROGRAM" "$SCENES/$1.txt" --headless $(backendOptions "$2") \
+     --size "$4" "$5" --spp "$6" --seed "$SEED" --checkpoint-interval 0 \
+     "$(outputOption "$2")" "$3" > "$OUTPUT/$1.$2.log" 2>&1)
+  STATUS=$?
+  END=$(date +%s.%N)
+  if [ $STATUS -eq 0 ] && [ "$2" = tiled ]
+  then
+    (cd "$OUTPUT" && "$PROGRAM" --from-hdr "$3" --headless >> "$OUTPUT/$1.$2.log" 2>&1)
+    STATUS=$?
+  fi
+  awk "BEGIN { print $END - $START }"
+  return $STATUS
+}
+
+FAILURES=0
+declare -A TOTAL
+
+printf "%-24s %-14s  %s\n" "scene" "backend" "result"
+
+for NAME in "${NAMES[@]}"
+do
+  if [ ! -f "$SCENES/$NAME.txt" ]
+  then
+    echo "There is no scene $SCENES/$NAME.txt"
+    FAILURES=$((FAILURES + 1))
+    continue
+  fi
+
+  if [ $UPDATE -eq 1 ]
+  then
+    if ! render "$NAME" single-thread "$GOLDEN/$NAME.pfm" "$WIDTH" "$HEIGHT" "$SPP" > /dev/null
+    then
+      echo "$NAME: the golden render failed, see $OUTPUT/$NAME.single-thread.log"
+      FAILURES=$((FAILURES + 1))
+      continue
+    fi
+  fi
+
+  for BACKEND in $BACKENDS
+  do
+    IMAGE="$OUTPUT/$NAME.$BACKEND.$(imageExtension "$BACKEND")"
+    rm -f "$IMAGE"
+
+    if ! render "$NAME" "$BACKEND" "$IMAGE" "$WIDTH" "$HEIGHT" "$SPP" > /dev/null
+    then
+      RESULT="FAILED, render error (see $OUTPUT/$NAME.$BACKEND.log)"
+      FAILURES=$((FAILURES + 1))
+    elif [ ! -f "$GOLDEN/$NAME.pfm" ]
+    then
+      RESULT="FAILED, no golden image (run with --update)"
+      FAILURES=$((FAILURES + 1))
+    elif COMPARISON=$("$PROGRAM" --compare "$GOLDEN/$NAME.pfm" "$IMAGE" --tolerance "$ABSOLUTE" "$RELATIVE")
+    then
+      RESULT="ok, ${COMPARISON#*: }"
+    else
+      RESULT="FAILED, ${COMPARISON#*: }"
+      FAILURES=$((FAILURES + 1))
+    fi
+
+    printf "%-24s %-14s  %s\n" "$NAME" "$BACKEND" "$RESULT"
+  done
+done
+
+# NOTE(ralntdir): The images above take a few milliseconds, about what it
+# takes to start the program, so the times come from renders of their
+# own that are large enough to measure.
+if [ $TIMING -eq 1 ]
+then
+  echo
+  printf "%-24s %-14s %9s %8s\n" "scene" "backend" "time" "speedup"
+
+  for NAME in "${NAMES[@]}"
+  do
+    if [ ! -f "$SCENES/$NAME.txt" ]
+    then
+      continue
+    fi
+
+    BASELINE=""
+    for BACKEND in $BACKENDS
+    do
+      IMAGE="$OUTPUT/$NAME.$BACKEND.timing.$(imageExtension "$BACKEND")"
+      if ! SECONDS_TAKEN=$(render "$NAME" "$BACKEND" "$IMAGE" "$TIMING_WIDTH" "$TIMING_HEIGHT" "$TIMING_SPP")
+      then
+        echo "$NAME: the $BACKEND timing render failed, see $OUTPUT/$NAME.$BACKEND.log"
+        FAILURES=$((FAILURES + 1))
+        continue
+      fi
+
+      # NOTE(ralntdir): Speedup over the first backend of the list.
+      if [ -z "$BASELINE" ]
+      then
+        BASELINE=$SECONDS_TAKEN
+      fi
+      SPEEDUP=$(awk "BEGIN { print $BASELINE / $SECONDS_TAKEN }")
+      TOTAL[$BACKEND]=$(awk "BEGIN { print ${TOTAL[$BACKEND]:-0} + $SECONDS_TAKEN }")
+
+      printf "%-24s %-14s %8.2fs %7.2fx\n" "$NAME" "$BACKEND" "$SECONDS_TAKEN" "$SPEEDUP"
+    done
+  done
+
+  echo
+  FIRST=""
+  for BACKEND in $BACKENDS
+  do
+    if [ -z "$FIRST" ]
+    then
+      FIRST=${TOTAL[$BACKEND]:-0}
+    fi
+    SPEEDUP=$(awk "BEGIN { print $FIRST / ${TOTAL[$BACKEND]:-1} }")
+    printf "%-24s %-14s %8.2fs %7.2fx\n" "total" "$BACKEND" "${TOTAL[$BACKEND]:-0}" "$SPEEDUP"
+  done
+fi
+
+if [ $FAILURES -ne 0 ]
+then
+  echo "$FAILURES failed"
+  exit 1
+fi
+
+echo "All images match the golden ones"
@@ -19,26 +19,83 @@
 // NOTE(ralntdir): For number types
 #include <stdint.h>
 
-// NOTE(ralntdir): For rand
-#include <random>
+// NOTE(ralntdir): For objects and instances
+#include <vector>
+
+// NOTE(ralntdir): For the checkpoint writer thread and timing
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+// NOTE(ralntdir): To stop a render cleanly on SIGINT/SIGTERM
+#include <signal.h>
+
+// NOTE(ralntdir): To see when the scene file changes
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
 
 // NOTE(ralntdir): For FLT_MAX
 #include <float.h>
 
+// NOTE(ralntdir): For std::count over the chunks of a scene file and the
+// number of threads in the stats
+#include <algorithm>
+#include <omp.h>
+
+// NOTE(ralntdir): For strcmp, atof and rename
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+typedef uint8_t uint8;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
 typedef int32_t int32;
 
 typedef float real32;
 typedef double real64;
 
-// TODO(ralntdir): read this from a scene file?
+// NOTE(ralntdir): Default size of the image, --size changes it.
 #define WIDTH 500
 #define HEIGHT 500
 #define MAX_COLOR 255
 #define MAX_SAMPLES 100
+#define SAMPLES_PER_PASS 4
 #define MAX_DEPTH 5
+// NOTE(ralntdir): A reflection that would be scaled by less than this
+// (kr times the kr of the mirrors before it) isn't traced, it can't
+// change the pixel by more than a step of the 8 bit output.
+#define MIN_PATH_THROUGHPUT (1.0f/1024.0f)
+// NOTE(ralntdir): Scenes with up to this many lights are shaded with all
+// of them unless --light-samples says otherwise.
+#define MAX_LIGHTS_SHADED_ALL 8
+// NOTE(ralntdir): The interactive mode renders again what changed in
+// squares of this many pixels.
+#define TILE_SIZE 32
+// NOTE(ralntdir): --tiled-output renders and writes tiles of this many
+// pixels, one per thread at a time.
+#define OUTPUT_TILE_SIZE 64
+// NOTE(ralntdir): While the camera moves the interactive mode renders 1
+// sample for every scale x scale pixels, with the scale adjusted to fit
+// a frame in this time.
+#define PREVIEW_FRAME_MILLISECONDS 33.0
+#define PREVIEW_MAX_SCALE 16
+// NOTE(ralntdir): Units per second and degrees per pixel of mouse movement.
+#define CAMERA_SPEED 2.0f
+#define CAMERA_FAST_SPEED 8.0f
+#define CAMERA_DEGREES_PER_PIXEL 0.2f
 
 #include <math.h>
 #include "myMath.h"
+#include "image.h"
+#include "denoise.h"
+#include "accumulation.h"
+#include "bvh.h"
+#include "lights.h"
+#include "camera.h"
+#include "materials.h"
+#include "parser.h"
 
 struct ray
 {
@@ -46,17 +103,6 @@ struct ray
   vec3 direction;
 };
 
-struct materialParameters
-{
-  vec3 ka;
-  vec3 kd;
-  vec3 ks;
-
-  vec3 kr;
-
-  real32 alpha;
-};
-
 enum mesh_type
 {
   sphere,
@@ -87,34 +133,86 @@ struct mesh
   materialParameters material;
 };
 
-enum light_type
+// NOTE(ralntdir): Geometry that is defined once and placed many times
+// by instances. Its meshes are in object space.
+struct object
+{
+  std::string name;
+  std::vector<mesh> meshes;
+  aabb bounds;
+
+  // NOTE(ralntdir): Bottom level, over the meshes of the object.
+  bvh tree;
+};
+
+// NOTE(ralntdir): A placement of an object, it only stores the
+// transform, so memory grows with the unique geometry and not with the
+// number of copies.
+struct instance
 {
-  point,
-  directional,
+  int32 objectIndex;
+  mat4 objectToWorld;
+  mat4 worldToObject;
+
+  // NOTE(ralntdir): If set, it replaces the materials of the meshes
+  // of the object.
+  bool overrideMaterial;
+  materialParameters material;
 };
 
-struct light
+// NOTE(ralntdir): Rays traced by a render, and the reflections that
+// weren't, because they couldn't be seen or because of the bounces of
+// their material. Every thread counts its own and adds them up after.
+struct rayCounters
 {
-  vec3 position;
-  vec3 intensity;
-  light_type type;
+  uint64 camera;
+  uint64 shadow;
+  uint64 reflection;
+  uint64 refraction;
+  uint64 reflectionsCut;
+  uint64 reflectionsLimited;
 };
 
 struct scene
 {
-  vec3 camera;
-  vec3 ul;
-  vec3 ur;
-  vec3 lr;
-  vec3 ll;
+  camera view;
 
-  int32 maxMeshes = 8;
-  int32 maxLights = 2;
+  std::vector<light> lights;
 
-  int32 numMeshes;
-  int32 numLights;
-  light lights[2];
-  mesh meshes[8];
+  // NOTE(ralntdir): Lights picked from the light tree at every hit, 0
+  // shades every hit with all the lights.
+  int32 lightSamples;
+  lightTree lightHierarchy;
+
+  std::vector<mesh> meshes;
+  std::vector<object> objects;
+  std::vector<instance> instances;
+
+  // NOTE(ralntdir): Top level, over the meshes of the scene and the
+  // instances. Index i < meshes.size() is meshes[i], the rest are
+  // instances[i - meshes.size()].
+  bvh topLevel;
+
+  // NOTE(ralntdir): Of all the renders of the scene so far.
+  rayCounters rays;
+};
+
+// NOTE(ralntdir): Which mesh a ray hit, instanceIndex is -1 for the
+// meshes that are directly in the scene (scene->meshes).
+struct hitRecord
+{
+  real32 t;
+  int32 instanceIndex;
+  int32 meshIndex;
+};
+
+// NOTE(ralntdir): What a camera ray hits first, it's what the
+// denoiser uses to find the edges.
+struct firstHitInfo
+{
+  vec3 albedo;
+  vec3 normal;
+  real32 depth;
 };
 
 bool hitSphere(mesh mySphere, ray myRay, real32 *t)
@@ -135,22 +233,36 @@ bool hitSphere(mesh mySphere, ray myRay, real32 *t)
   }
   else
   {
-    result = true;
+    // NOTE(ralntdir): -b +- sqrt(discriminant) cancels out when both
+    // are close, which is what happens for rays that start on the
+    // sphere. q has no cancellation and the other root comes from
+    // root1*root2 = c/a.
+    real32 q = (b < 0.0) ? -0.5*(b - sqrt(discriminant)) : -0.5*(b + sqrt(discriminant));
+    if (q == 0.0)
+    {
+      return(result);
+    }
 
-    real32 root1 = (-b + sqrt(discriminant))/(2*a);
-    real32 root2 = (-b - sqrt(discriminant))/(2*a);
+    real32 root1 = q/a;
+    real32 root2 = c/q;
+    if (root2 < root1)
+    {
+      real32 temp = root1;
+      root1 = root2;
+      root2 = temp;
+    }
 
-    if ((root1 < root2) && (root1 > 0.0))
+    // NOTE(ralntdir): The far root is the hit for rays that start
+    // inside the sphere.
+    if (root1 > 0.0)
     {
       *t = root1;
+      result = true;
     }
-    else if ((root2 < root1) && (root2 > 0.0))
+    else if (root2 > 0.0)
     {
       *t = root2;
-    }
-    else if ((root1 < 0) && (root2 < 0))
-    {
-      result = false;
+      result = true;
     }
   }
 
@@ -182,35 +294,14 @@ bool hitPlane(mesh myPlane, ray myRay, real32 *t)
 }
 
 // TODO(ralntdir): add attenuation for point lights
-vec3 phongIllumination(light myLight, mesh myMesh, vec3 camera, vec3 hitPoint, real32 visible)
+// NOTE(ralntdir): L comes from sampleLight(), for area lights it's the
+// direction of one sample.
+vec3 phongIllumination(vec3 L, vec3 intensity, materialParameters material, vec3 N, vec3 camera, vec3 hitPoint)
 {
   vec3 result;
 
   // *N vector (normal at hit point)
   // *L vector (lightPosition - hitPoint)
-  vec3 N = {};
-  if (myMesh.type == sphere)
-  {
-    N = normalize(hitPoint - myMesh.center);
-  }
-  else if (myMesh.type == plane)
-  {
-    N = myMesh.normal;
-  }
-  else if (myMesh.type == triangle)
-  {
-    N = myMesh.normal;
-  }
-
-  vec3 L = {};
-  if (myLight.type == point)
-  {
-    L = normalize(myLight.position - hitPoint);
-  }
-  else if (myLight.type == directional)
-  {
-    L = normalize(-myLight.position);
-  }
   real32 dotProductLN = max(dotProduct(L, N), 0.0);
   real32 filterSpecular = dotProductLN > 0.0 ? 1.0 : 0.0;
 
@@ -221,8 +312,8 @@ vec3 phongIllumination(light myLight, mesh myMesh, vec3 camera, vec3 hitPoint, r
 
   // Only add specular component if you have diffuse,
   // if dotProductLN > 0.0
-  result = 1.0*visible*myMesh.material.kd*myLight.intensity*dotProductLN +
-           visible*filterSpecular*myMesh.material.ks*myLight.intensity*pow(max(dotProduct(R, V), 0.0), myMesh.material.alpha);
+  result = 1.0*material.kd*intensity*dotProductLN +
+           filterSpecular*material.ks*intensity*pow(max(dotProduct(R, V), 0.0), material.alpha);
 
   return(result);
 }
@@ -370,466 +461,3526 @@ vec3 blinnPhongShading(light myLight, mesh mySphere, vec3 camera, vec3 hitPoint,
   return(result);
 }
 
-ray getShadowRay(light myLight, vec3 hitPoint, vec3 normalAtHitPoint)
+// NOTE(ralntdir): Only for lights above the surface, L·N > 0.
+ray getShadowRay(vec3 hitPoint, vec3 normalAtHitPoint, vec3 L)
 {
   ray result = {};
 
-  // NOTE(ralntdir): delta to avoid shadow acne.
-  real32 bias = 0.00;
-  // real32 bias = 0.01;
+  // NOTE(ralntdir): Moved off the surface to avoid shadow acne.
+  result.origin = offsetRayOrigin(hitPoint, normalAtHitPoint);
+  result.direction = L;
+
+  return(result);
+}
 
-  result.origin = hitPoint + normalAtHitPoint*bias;
+// NOTE(ralntdir): The normal of the mesh at a point, both in the space
+// the mesh is defined in.
+vec3 meshNormal(mesh *myMesh, vec3 hitPoint)
+{
+  vec3 result = {};
 
-  if (myLight.type == directional)
+  if (myMesh->type == sphere)
+  {
+    result = normalize(hitPoint - myMesh->center);
+  }
+  else if (myMesh->type == plane)
   {
-    result.direction = normalize(-myLight.position);
+    result = myMesh->normal;
   }
-  else if (myLight.type == point)
+  else if (myMesh->type == triangle)
   {
-    result.direction = normalize(myLight.position - hitPoint);
+    result = myMesh->normal;
   }
 
   return(result);
 }
 
-vec3 color(ray myRay, scene *myScene, vec3 backgroundColor, int32 depth)
+aabb meshBounds(mesh *myMesh)
 {
-  // vec3 result = backgroundColor;
-  vec3 result = { 0.0, 0.0, 0.0 };
+  aabb result = emptyBounds();
 
-  if (depth <= MAX_DEPTH)
+  if (myMesh->type == sphere)
+  {
+    vec3 radius = { myMesh->radius, myMesh->radius, myMesh->radius };
+    result.min = myMesh->center - radius;
+    result.max = myMesh->center + radius;
+  }
+  else if (myMesh->type == plane)
+  {
+    result = infiniteBounds();
+  }
+  else if (myMesh->type == triangle)
   {
-    real32 mint = FLT_MAX;
-    real32 t = -1.0;
+    result = grow(grow(grow(result, myMesh->a), myMesh->b), myMesh->c);
+  }
 
-    for (int i = 0; i < myScene->numMeshes; i++)
-    {
-      mesh myMesh = myScene->meshes[i];
-      if (hitMesh(myMesh, myRay, &t))
-      {
-        if ((t >= 0.0) && (t < mint))
-        {
-          result = {};
-          // NOTE(ralntdir): Let's suppose that ia is (1.0, 1.0, 1.0)
-          if (depth == 1)
-          {
-            result += myMesh.material.ka;
-          }
-          mint = t;
-          vec3 hitPoint = myRay.origin + t*myRay.direction;
+  return(result);
+}
 
-          vec3 N = {};
+// NOTE(ralntdir): The ray is taken to object space, but its direction
+// isn't normalized, so t means the same in both spaces.
+ray worldToObjectRay(instance *myInstance, ray myRay)
+{
+  ray result = {};
 
-          if (myMesh.type == sphere)
-          {
-            N = normalize(hitPoint - myMesh.center);
-          }
-          else if (myMesh.type == plane)
-          {
-            N = myMesh.normal;
-          }
-          else if (myMesh.type == triangle)
-          {
-            N = myMesh.normal;
-          }
+  result.origin = transformPoint(myInstance->worldToObject, myRay.origin);
+  result.direction = transformVector(myInstance->worldToObject, myRay.direction);
 
-          hitPoint += 0.01*N;
+  return(result);
+}
 
-          for (int j = 0; j < myScene->numLights; j++)
-          {
-            light myLight = myScene->lights[j];
-
-            ray shadowRay = getShadowRay(myLight, hitPoint, N);
-
-            real32 visible = 1.0;
-
-            for (int k = 0; k < myScene->numMeshes; k++)
-            {
-              // TODO(ralntdir): check if this filtering is right
-              if (i != k)
-              {
-                mesh myMesh1 = myScene->meshes[k];
-                real32 t1 = -1.0;
-                if (hitMesh(myMesh1, shadowRay, &t1))
-                {
-                  visible = 0.0;
-                  break;
-                }
-              }
-            }
-            result += phongIllumination(myLight, myMesh, myScene->camera, hitPoint, visible);
-          }
+vec3 inverseDirection(vec3 direction)
+{
+  vec3 result = { 1.0f/direction.x, 1.0f/direction.y, 1.0f/direction.z };
+
+  return(result);
+}
 
-          // Add reflection
-          ray reflectedRay = {};
-          reflectedRay.origin = hitPoint + N*0.01;
-          reflectedRay.direction = normalize(2*dotProduct(-myRay.direction, N)*N + myRay.direction);
-          // reflectedRay.direction = 2*dotProduct(-myRay.direction, N)*N + myRay.direction;
+// NOTE(ralntdir): The state of one ray going through the scene.
+struct traversal
+{
+  hitRecord *hit;
+  bool anyHit;
 
-          result += myMesh.material.kr*color(reflectedRay, myScene, backgroundColor, depth+1);
-        }
-      }
+  real32 mint;
+  bool found;
+};
+
+// NOTE(ralntdir): Returns true when the traversal can stop.
+bool testMesh(traversal *trav, mesh *myMesh, ray myRay, int32 instanceIndex, int32 meshIndex)
+{
+  bool result = false;
+
+  real32 t = -1.0;
+  bool hitFound = hitMesh(*myMesh, myRay, &t);
+
+  if (hitFound && (t >= 0.0) && (t < trav->mint))
+  {
+    if (!trav->anyHit)
+    {
+      trav->mint = t;
     }
+    trav->hit->t = t;
+    trav->hit->instanceIndex = instanceIndex;
+    trav->hit->meshIndex = meshIndex;
+    trav->found = true;
+
+    result = trav->anyHit;
   }
+
   return(result);
 }
 
-void readSceneFile(scene *myScene, char *filename)
+// NOTE(ralntdir): Bottom level, the ray is already in object space.
+bool traverseObject(traversal *trav, object *myObject, ray objectRay, int32 instanceIndex)
 {
-  std::string line;
-  std::ifstream scene(filename);
+  bvh *tree = &myObject->tree;
 
-  if (scene.is_open())
+  for (size_t i = 0; i < tree->unbounded.size(); i++)
   {
-    while (!scene.eof())
+    int32 index = tree->unbounded[i];
+    if (testMesh(trav, &myObject->meshes[index], objectRay, instanceIndex, index))
     {
-      scene >> line;
-
-      // If line is not a comment
-      if (line[0] == '#')
-      {
-        std::getline(scene, line);
-        std::cout << line << "\n";
-      }
-      else
-      {
-        std::cout << line << "\n";
+      return(true);
+    }
+  }
 
-        if (line == "camera")
-        {
-          scene >> myScene->camera.x;
-          scene >> myScene->camera.y;
-          scene >> myScene->camera.z;
-        }
-        else if (line == "sphere")
-        {
-          mesh mySphere = {};
-          mySphere.type = sphere;
-
-          scene >> line; // center
-          scene >> mySphere.center.x;
-          scene >> mySphere.center.y;
-          scene >> mySphere.center.z;
-          scene >> line; // radius
-          scene >> mySphere.radius;
-          scene >> line; // ka
-          scene >> mySphere.material.ka.r;
-          scene >> mySphere.material.ka.g;
-          scene >> mySphere.material.ka.b;
-          scene >> line; // kd
-          scene >> mySphere.material.kd.r;
-          scene >> mySphere.material.kd.g;
-          scene >> mySphere.material.kd.b;
-          scene >> line; // ks
-          scene >> mySphere.material.ks.r;
-          scene >> mySphere.material.ks.g;
-          scene >> mySphere.material.ks.b;
-          scene >> line; // kr || alpha
-          if (line == "kr")
-          {
-            scene >> mySphere.material.kr.r;
-            scene >> mySphere.material.kr.g;
-            scene >> mySphere.material.kr.b;
-            scene >> line; // alpha
-            scene >> mySphere.material.alpha;
-          }
-          else if (line == "alpha")
-          {
-            scene >> mySphere.material.alpha;
-          }
+  if (tree->nodes.empty())
+  {
+    return(false);
+  }
 
-          myScene->numMeshes++;
-          if (myScene->numMeshes <= myScene->maxMeshes)
-          {
-            myScene->meshes[myScene->numMeshes-1] = mySphere;
-          }
-        }
-        else if (line == "plane")
-        {
-          mesh myPlane = {};
-          myPlane.type = plane;
-
-          scene >> line; // normal
-          scene >> myPlane.normal.x;
-          scene >> myPlane.normal.y;
-          scene >> myPlane.normal.z;
-          myPlane.normal = normalize(myPlane.normal);
-          scene >> line; // p0
-          scene >> myPlane.p0.x;
-          scene >> myPlane.p0.y;
-          scene >> myPlane.p0.z;
-          scene >> line; // ka
-          scene >> myPlane.material.ka.r;
-          scene >> myPlane.material.ka.g;
-          scene >> myPlane.material.ka.b;
-          scene >> line; // kd
-          scene >> myPlane.material.kd.r;
-          scene >> myPlane.material.kd.g;
-          scene >> myPlane.material.kd.b;
-          scene >> line; // ks
-          scene >> myPlane.material.ks.r;
-          scene >> myPlane.material.ks.g;
-          scene >> myPlane.material.ks.b;
-          scene >> line; // kr || alpha
-          if (line == "kr")
-          {
-            scene >> myPlane.material.kr.r;
-            scene >> myPlane.material.kr.g;
-            scene >> myPlane.material.kr.b;
-            scene >> line; // alpha
-            scene >> myPlane.material.alpha;
-          }
-          else if (line == "alpha")
-          {
-            scene >> myPlane.material.alpha;
-          }
+  vec3 invDirection = inverseDirection(objectRay.direction);
 
-          myScene->numMeshes++;
-          if (myScene->numMeshes <= myScene->maxMeshes)
-          {
-            myScene->meshes[myScene->numMeshes-1] = myPlane;
-          }
-        }
-        else if (line == "triangle")
-        {
-          mesh myTriangle = {};
-          myTriangle.type = triangle;
-
-          scene >> line; // a
-          scene >> myTriangle.a.x;
-          scene >> myTriangle.a.y;
-          scene >> myTriangle.a.z;
-          scene >> line; // b
-          scene >> myTriangle.b.x;
-          scene >> myTriangle.b.y;
-          scene >> myTriangle.b.z;
-          scene >> line; // c
-          scene >> myTriangle.c.x;
-          scene >> myTriangle.c.y;
-          scene >> myTriangle.c.z;
-
-          vec3 ab = myTriangle.a - myTriangle.b;
-          vec3 ac = myTriangle.a - myTriangle.c;
-          myTriangle.normal = normalize(crossProduct(ab, ac));
-
-          scene >> line; // ka
-          scene >> myTriangle.material.ka.r;
-          scene >> myTriangle.material.ka.g;
-          scene >> myTriangle.material.ka.b;
-          scene >> line; // kd
-          scene >> myTriangle.material.kd.r;
-          scene >> myTriangle.material.kd.g;
-          scene >> myTriangle.material.kd.b;
-          scene >> line; // ks
-          scene >> myTriangle.material.ks.r;
-          scene >> myTriangle.material.ks.g;
-          scene >> myTriangle.material.ks.b;
-          scene >> line; // kr || alpha
-          if (line == "kr")
-          {
-            scene >> myTriangle.material.kr.r;
-            scene >> myTriangle.material.kr.g;
-            scene >> myTriangle.material.kr.b;
-            scene >> line; // alpha
-            scene >> myTriangle.material.alpha;
-          }
-          else if (line == "alpha")
-          {
-            scene >> myTriangle.material.alpha;
-          }
+  int32 stack[BVH_MAX_DEPTH + 2];
+  int32 stackSize = 0;
 
-          myScene->numMeshes++;
-          if (myScene->numMeshes <= myScene->maxMeshes)
-          {
-            myScene->meshes[myScene->numMeshes-1] = myTriangle;
-          }
-        }
-        else if (line == "light")
-        {
-          light myLight = {};
-
-          scene >> line; // position
-          scene >> myLight.position.x;
-          scene >> myLight.position.y;
-          scene >> myLight.position.z;
-          scene >> line; // intensity
-          scene >> myLight.intensity.r;
-          scene >> myLight.intensity.g;
-          scene >> myLight.intensity.b;
-          scene >> line; // type
-          scene >> line;
-
-          if (line.compare("point") == 0)
-          {
-            myLight.type = point;
-          }
-          else if (line.compare("directional") == 0)
-          {
-            myLight.type = directional;
-          }
+  if (boundsDistance(tree->nodes[0].bounds, objectRay.origin, invDirection, trav->mint) != FLT_MAX)
+  {
+    stack[stackSize++] = 0;
+  }
 
-          myScene->numLights++;
-          if (myScene->numLights <= myScene->maxLights)
-          {
-            myScene->lights[myScene->numLights-1] = myLight;
-          }
-        }
-        else if (line == "ul")
-        {
-          vec3 ul = {};
-          scene >> ul.x;
-          scene >> ul.y;
-          scene >> ul.z;
+  while (stackSize > 0)
+  {
+    bvhNode *node = &tree->nodes[stack[--stackSize]];
 
-          myScene->ul = ul;
-        }
-        else if (line == "ur")
-        {
-          vec3 ur = {};
-          scene >> ur.x;
-          scene >> ur.y;
-          scene >> ur.z;
+    // NOTE(ralntdir): The node was pushed before a closer hit was found.
+    if (boundsDistance(node->bounds, objectRay.origin, invDirection, trav->mint) == FLT_MAX)
+    {
+      continue;
+    }
 
-          myScene->ur = ur;
-        }
-        else if (line == "lr")
+    if (node->count)
+    {
+      for (int32 i = node->first; i < node->first + node->count; i++)
+      {
+        int32 index = tree->indices[i];
+        if (testMesh(trav, &myObject->meshes[index], objectRay, instanceIndex, index))
         {
-          vec3 lr = {};
-          scene >> lr.x;
-          scene >> lr.y;
-          scene >> lr.z;
-
-          myScene->lr = lr;
+          return(true);
         }
-        else if (line == "ll")
-        {
-          vec3 ll = {};
-          scene >> ll.x;
-          scene >> ll.y;
-          scene >> ll.z;
+      }
+    }
+    else
+    {
+      // NOTE(ralntdir): Nearest child last, so it's visited first.
+      int32 near = node->first;
+      int32 far = node->first + 1;
+      real32 tNear = boundsDistance(tree->nodes[near].bounds, objectRay.origin, invDirection, trav->mint);
+      real32 tFar = boundsDistance(tree->nodes[far].bounds, objectRay.origin, invDirection, trav->mint);
+      if (tFar < tNear)
+      {
+        int32 temp = near; near = far; far = temp;
+        real32 tTemp = tNear; tNear = tFar; tFar = tTemp;
+      }
 
-          myScene->ll = ll;
-        }
+      if (tFar != FLT_MAX)
+      {
+        stack[stackSize++] = far;
+      }
+      if (tNear != FLT_MAX)
+      {
+        stack[stackSize++] = near;
       }
     }
-    scene.close();
+  }
+
+  return(false);
+}
+
+// NOTE(ralntdir): A primitive of the top level, a mesh of the scene or
+// an instance.
+bool testTopLevel(traversal *trav, scene *myScene, ray myRay, int32 index)
+{
+  bool result = false;
+  int32 numMeshes = (int32)myScene->meshes.size();
+
+  if (index < numMeshes)
+  {
+    result = testMesh(trav, &myScene->meshes[index], myRay, -1, index);
   }
   else
   {
-    std::cout << "There was a problem opening the scene file\n";
+    int32 instanceIndex = index - numMeshes;
+    instance *myInstance = &myScene->instances[instanceIndex];
+    object *myObject = &myScene->objects[myInstance->objectIndex];
+
+    result = traverseObject(trav, myObject, worldToObjectRay(myInstance, myRay), instanceIndex);
   }
+
+  return(result);
 }
 
-int main(int argc, char* argv[])
+// NOTE(ralntdir): Finds the closest hit before tMax. If anyHit is set,
+// it stops at the first hit before tMax, which is all a shadow ray
+// needs. Rays leaving a surface have to start off it (offsetRayOrigin),
+// nothing is skipped here.
+bool traceRay(scene *myScene, ray myRay, hitRecord *hit, real32 tMax, bool anyHit)
 {
-  SDL_Window *window;
-  SDL_Renderer *renderer;
-  SDL_Surface *surface;
-  SDL_Texture *texture;
+  traversal trav = {};
+  trav.hit = hit;
+  trav.anyHit = anyHit;
+  trav.mint = tMax;
 
-  if (argc < 2)
+  bvh *tree = &myScene->topLevel;
+
+  for (size_t i = 0; i < tree->unbounded.size(); i++)
   {
-    std::cout << "Missing scene file. Usage: ./program sceneFile\n";
-    return(1);
+    if (testTopLevel(&trav, myScene, myRay, tree->unbounded[i]))
+    {
+      return(trav.found);
+    }
+  }
+
+  if (tree->nodes.empty())
+  {
+    return(trav.found);
   }
-  char *sceneFileName = argv[1];
 
-  // Init SDL
-  if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
+  vec3 invDirection = inverseDirection(myRay.direction);
+
+  int32 stack[BVH_MAX_DEPTH + 2];
+  int32 stackSize = 0;
+
+  if (boundsDistance(tree->nodes[0].bounds, myRay.origin, invDirection, trav.mint) != FLT_MAX)
   {
-    std::cout << "Error in SDL_Init(): " << SDL_GetError() << "\n";
+    stack[stackSize++] = 0;
   }
 
-  // Init SDL_Image
-  if (IMG_Init(0) < 0)
+  while (stackSize > 0)
   {
-    std::cout << "Error in IMG_Init(): " << IMG_GetError() << "\n";
+    bvhNode *node = &tree->nodes[stack[--stackSize]];
+
+    // NOTE(ralntdir): The node was pushed before a closer hit was found.
+    if (boundsDistance(node->bounds, myRay.origin, invDirection, trav.mint) == FLT_MAX)
+    {
+      continue;
+    }
+
+    if (node->count)
+    {
+      for (int32 i = node->first; i < node->first + node->count; i++)
+      {
+        if (testTopLevel(&trav, myScene, myRay, tree->indices[i]))
+        {
+          return(trav.found);
+        }
+      }
+    }
+    else
+    {
+      int32 near = node->first;
+      int32 far = node->first + 1;
+      real32 tNear = boundsDistance(tree->nodes[near].bounds, myRay.origin, invDirection, trav.mint);
+      real32 tFar = boundsDistance(tree->nodes[far].bounds, myRay.origin, invDirection, trav.mint);
+      if (tFar < tNear)
+      {
+        int32 temp = near; near = far; far = temp;
+        real32 tTemp = tNear; tNear = tFar; tFar = tTemp;
+      }
+
+      if (tFar != FLT_MAX)
+      {
+        stack[stackSize++] = far;
+      }
+      if (tNear != FLT_MAX)
+      {
+        stack[stackSize++] = near;
+      }
+    }
   }
 
-  // Create a Window
-  // NOTE(ralntdir): SDL_WINDOW_SHOWN is ignored by SDL_CreateWindow().
-  // The SDL_Window is implicitly shown if SDL_WINDOW_HIDDEN is not set.
-  window = SDL_CreateWindow("Devember RT", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                            WIDTH, HEIGHT, SDL_WINDOW_SHOWN);
+  return(trav.found);
+}
+
+// NOTE(ralntdir): Each level is built on its own. An object only needs
+// its own tree rebuilt when its meshes change, and the top level only
+// looks at the bounds of the objects, not at their meshes.
+// NOTE(ralntdir): The bounds of every mesh of the object, also updates
+// the bounds of the whole object.
+void objectMeshBounds(object *myObject, std::vector<aabb> *bounds)
+{
+  int32 count = (int32)myObject->meshes.size();
+  bounds->resize(count);
+
+  #pragma omp parallel for if (count > BVH_PARALLEL_SIZE)
+  for (int32 i = 0; i < count; i++)
+  {
+    (*bounds)[i] = meshBounds(&myObject->meshes[i]);
+  }
 
-  if (window == 0)
+  myObject->bounds = emptyBounds();
+  for (int32 i = 0; i < count; i++)
   {
-    std::cout << "Error in SDL_CreateWindow(): " << SDL_GetError() << "\n";
+    myObject->bounds = grow(myObject->bounds, (*bounds)[i]);
   }
+}
+
+// NOTE(ralntdir): In the order of the top level indices, the meshes of
+// the scene first and then the instances.
+void topLevelBounds(scene *myScene, std::vector<aabb> *bounds)
+{
+  int32 numMeshes = (int32)myScene->meshes.size();
+  int32 numInstances = (int32)myScene->instances.size();
+  bounds->resize(numMeshes + numInstances);
 
-  // Create a Renderer
-  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+  #pragma omp parallel for if (numMeshes > BVH_PARALLEL_SIZE)
+  for (int32 i = 0; i < numMeshes; i++)
+  {
+    (*bounds)[i] = meshBounds(&myScene->meshes[i]);
+  }
 
-  if (renderer == 0)
+  #pragma omp parallel for if (numInstances > BVH_PARALLEL_SIZE)
+  for (int32 i = 0; i < numInstances; i++)
   {
-    std::cout << "Error in SDL_CreateRenderer(): " << SDL_GetError() << "\n";
+    instance *myInstance = &myScene->instances[i];
+    object *myObject = &myScene->objects[myInstance->objectIndex];
+
+    (*bounds)[numMeshes + i] = transformBounds(myInstance->objectToWorld, myObject->bounds);
   }
+}
 
-  scene myScene = {};
-  // Read scene file
-  readSceneFile(&myScene, sceneFileName);
+// NOTE(ralntdir): How long each step of loading a scene took, for --stats.
+struct startupTimes
+{
+  real64 readMilliseconds;
+  real64 parseMilliseconds;
+  int32 chunks;
+  real64 boundsMilliseconds;
+  real64 bvhMilliseconds;
+  real64 lightTreeMilliseconds;
+};
 
-  // Create a .ppm file 
-  std::ofstream ofs("image.ppm", std::ofstream::out | std::ofstream::binary);
+// NOTE(ralntdir): Small objects are built at the same time, one on each
+// thread. A big one gets all the threads for its own tree, see buildBVH().
+// times gets how long each step took, if it isn't 0.
+void buildAccelerationStructures(scene *myScene, bool printStats, startupTimes *times)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-  ofs << "P3\n";
-  ofs << "# image.ppm\n";
-  ofs << WIDTH << " " << HEIGHT << "\n";
-  ofs << MAX_COLOR << "\n";
+  int32 numObjects = (int32)myScene->objects.size();
+  std::vector<std::vector<aabb> > objectBounds(numObjects);
+  for (int32 i = 0; i < numObjects; i++)
+  {
+    objectMeshBounds(&myScene->objects[i], &objectBounds[i]);
+  }
 
-  vec3 horizontalOffset = myScene.ur - myScene.ul;
-  vec3 verticalOffset = myScene.ul - myScene.ll;
-  vec3 lowerLeftCorner = myScene.ll;
+  std::vector<aabb> sceneBounds;
+  topLevelBounds(myScene, &sceneBounds);
 
-  // NOTE(ralntdir): generates random unsigned integers
-  std::default_random_engine engine;
-  // NOTE(ralntdir): generates random floats between [0, 1)
-  std::uniform_real_distribution<real32> distribution(0, 1);
+  std::chrono::steady_clock::time_point boundsEnd = std::chrono::steady_clock::now();
 
-  int32 depth = 1;
+  #pragma omp parallel for schedule(dynamic)
+  for (int32 i = 0; i < numObjects; i++)
+  {
+    if (objectBounds[i].size() <= BVH_PARALLEL_SIZE)
+    {
+      buildBVH(&myScene->objects[i].tree, objectBounds[i]);
+    }
+  }
 
-  // NOTE(ralntdir): From top to bottom
-  for (int32 i = HEIGHT-1; i >= 0 ; i--)
+  for (int32 i = 0; i < numObjects; i++)
   {
-    for (int32 j = 0; j < WIDTH; j++)
+    if (objectBounds[i].size() > BVH_PARALLEL_SIZE)
     {
-      vec3 backgroundColor = { 0.0, ((real32)i/HEIGHT), ((real32)j/WIDTH) };
-      vec3 col = {};
+      buildBVH(&myScene->objects[i].tree, objectBounds[i]);
+    }
+  }
 
-#if 0
-      #pragma omp declare reduction(vectorReduction:vec3: \
-                                    omp_out += omp_in)
+  buildBVH(&myScene->topLevel, sceneBounds);
 
-      #pragma omp parallel for reduction(vectorReduction:col)
-#endif
-      for (int32 samples = 0; samples < MAX_SAMPLES; samples++)
-      {
-        real32 u = real32(j + distribution(engine))/real32(WIDTH);
-        real32 v = real32(i + distribution(engine))/real32(HEIGHT);
+  std::chrono::steady_clock::time_point bvhEnd = std::chrono::steady_clock::now();
 
-        ray cameraRay = {};
-        cameraRay.origin = myScene.camera;
-        cameraRay.direction = normalize(lowerLeftCorner + u*horizontalOffset + v*verticalOffset);
+  buildLightTree(&myScene->lightHierarchy, myScene->lights);
 
-        vec3 tempCol = color(cameraRay, &myScene, backgroundColor, depth);
-        clamp(&tempCol);
-        col += tempCol;
-      }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
 
-      col /= (real32)MAX_SAMPLES;
+  if (printStats)
+  {
+    for (int32 i = 0; i < numObjects; i++)
+    {
+      object *myObject = &myScene->objects[i];
+      std::string name = "Object " + myObject->name;
+      printBVHStats(name.c_str(), &myObject->tree);
+    }
 
-      int32 r = int32(255.0*col.r);
-      int32 g = int32(255.0*col.g);
-      int32 b = int32(255.0*col.b);
+    printBVHStats("Top level", &myScene->topLevel);
 
-      ofs << r << " " << g << " " << b << "\n";
+    lightTree *tree = &myScene->lightHierarchy;
+    std::cout << "Light tree: " << myScene->lights.size() << " lights";
+    if (!tree->unbounded.empty())
+    {
+      std::cout << " (" << tree->unbounded.size() << " directional)";
     }
+    std::cout << ", " << tree->nodes.size() << " nodes, depth " << tree->maxDepth << "\n";
+  }
+
+  if (times)
+  {
+    times->boundsMilliseconds = std::chrono::duration<real64, std::milli>(boundsEnd - start).count();
+    times->bvhMilliseconds = std::chrono::duration<real64, std::milli>(bvhEnd - boundsEnd).count();
+    times->lightTreeMilliseconds = std::chrono::duration<real64, std::milli>(end - bvhEnd).count();
+  }
+}
+
+// NOTE(ralntdir): World space normal and material at the hit.
+void getSurface(scene *myScene, ray myRay, hitRecord *hit, vec3 *N, materialParameters *material)
+{
+  if (hit->instanceIndex == -1)
+  {
+    mesh *myMesh = &myScene->meshes[hit->meshIndex];
+    vec3 hitPoint = myRay.origin + hit->t*myRay.direction;
+
+    *N = meshNormal(myMesh, hitPoint);
+    *material = myMesh->material;
   }
+  else
+  {
+    instance *myInstance = &myScene->instances[hit->instanceIndex];
+    mesh *myMesh = &myScene->objects[myInstance->objectIndex].meshes[hit->meshIndex];
 
-  ofs.close();
+    ray objectRay = worldToObjectRay(myInstance, myRay);
+    vec3 objectHitPoint = objectRay.origin + hit->t*objectRay.direction;
+
+    *N = transformNormal(myInstance->worldToObject, meshNormal(myMesh, objectHitPoint));
+    *material = myInstance->overrideMaterial ? myInstance->material : myMesh->material;
+  }
+}
+
+// NOTE(ralntdir): The light that arrives at hitPoint from myLight. Area
+// lights take light.samples shadow rays at the first hit, stratified over
+// the light; the reflections only get one, they are scaled down by kr
+// and averaged over the pixel samples anyway.
+vec3 directLighting(scene *myScene, light *myLight, materialParameters material,
+                    vec3 N, vec3 hitPoint, int32 depth, randomSeries *series, rayCounters *counters)
+{
+  vec3 result = { 0.0, 0.0, 0.0 };
+
+  lightView view = viewLight(myLight, hitPoint);
+  if (!view.visible)
+  {
+    return(result);
+  }
+
+  bool area = isAreaLight(myLight);
+  int32 samples = (area && (depth == 1)) ? myLight->samples : 1;
+  int32 strata = (int32)sqrt((real32)samples);
+
+  for (int32 s = 0; s < samples; s++)
+  {
+    real32 u1 = 0.0;
+    real32 u2 = 0.0;
+    if (area)
+    {
+      u1 = randomUnilateral(series);
+      u2 = randomUnilateral(series);
+
+      // NOTE(ralntdir): One sample in each cell of a strata x strata
+      // grid, the samples that don't fill a whole row are uniform.
+      if (s < strata*strata)
+      {
+        u1 = ((s % strata) + u1)/strata;
+        u2 = ((s / strata) + u2)/strata;
+      }
+    }
+
+    lightSample sample = sampleLight(&view, u1, u2);
+    real32 falloff = rangeFalloff(sample.distance, myLight->range);
+
+    // NOTE(ralntdir): The shading is 0 for lights below the surface or
+    // out of range, no need to know if they are occluded.
+    if ((dotProduct(sample.L, N) > 0.0) && (falloff > 0.0))
+    {
+      ray shadowRay = getShadowRay(hitPoint, N, sample.L);
+      counters->shadow++;
+
+      hitRecord shadowHit = {};
+      if (!traceRay(myScene, shadowRay, &shadowHit, sample.distance, true))
+      {
+        result += phongIllumination(sample.L, falloff*myLight->intensity, material, N, myScene->view.position, hitPoint);
+      }
+    }
+  }
+
+  result /= (real32)samples;
+
+  return(result);
+}
+
+// NOTE(ralntdir): throughput is what the light that comes back along
+// myRay is scaled by on its way to the pixel, 1 for a camera ray.
+vec3 color(ray myRay, scene *myScene, vec3 backgroundColor, int32 depth, vec3 throughput,
+           firstHitInfo *firstHit, randomSeries *series, rayCounters *counters)
+{
+  // vec3 result = backgroundColor;
+  vec3 result = { 0.0, 0.0, 0.0 };
+
+  hitRecord hit = {};
+
+  if ((depth <= MAX_DEPTH) && traceRay(myScene, myRay, &hit, FLT_MAX, false))
+  {
+    vec3 N = {};
+    materialParameters material = {};
+    getSurface(myScene, myRay, &hit, &N, &material);
+
+    // NOTE(ralntdir): Let's suppose that ia is (1.0, 1.0, 1.0)
+    if (depth == 1)
+    {
+      result += material.ka;
+    }
+    vec3 hitPoint = myRay.origin + hit.t*myRay.direction;
+
+    if (firstHit)
+    {
+      firstHit->albedo = material.kd;
+      firstHit->normal = N;
+      firstHit->depth = hit.t;
+    }
+
+    if (myScene->lightSamples == 0)
+    {
+      for (size_t j = 0; j < myScene->lights.size(); j++)
+      {
+        result += directLighting(myScene, &myScene->lights[j], material, N, hitPoint, depth, series, counters);
+      }
+    }
+    else
+    {
+      // NOTE(ralntdir): A few lights picked at random, each divided by
+      // the probability of picking it, gives on average the same as all
+      // of them, for the price of a few.
+      lightTree *tree = &myScene->lightHierarchy;
+
+      for (size_t j = 0; j < tree->unbounded.size(); j++)
+      {
+        result += directLighting(myScene, &myScene->lights[tree->unbounded[j]], material, N, hitPoint, depth, series, counters);
+      }
+
+      for (int32 j = 0; j < myScene->lightSamples; j++)
+      {
+        real32 probability = 0.0;
+        int32 index = pickLight(tree, hitPoint, N, randomUnilateral(series), &probability);
+
+        if (index != -1)
+        {
+          vec3 lighting = directLighting(myScene, &myScene->lights[index], material, N, hitPoint, depth, series, counters);
+          result += lighting/(probability*myScene->lightSamples);
+        }
+      }
+    }
+
+    // Add reflection (or refraction)
+    // NOTE(ralntdir): A ray from the last bounce would end before tracing
+    // anything, so it isn't made.
+    if (depth < MAX_DEPTH)
+    {
+      scatterSample scattered = sampleScattering(&material, myRay.direction, N, series);
+      vec3 scatteredThroughput = throughput*scattered.weight;
+      real32 weight = max(max(scatteredThroughput.r, scatteredThroughput.g), scatteredThroughput.b);
+
+      if (weight < MIN_PATH_THROUGHPUT)
+      {
+        counters->reflectionsCut++;
+      }
+      else if (material.bounces && (depth > material.bounces))
+      {
+        counters->reflectionsLimited++;
+      }
+      else
+      {
+        ray scatteredRay = {};
+        scatteredRay.direction = scattered.direction;
+        scatteredRay.origin = offsetRayOrigin(hitPoint, (dotProduct(scatteredRay.direction, N) >= 0.0) ? N : -N);
+
+        if (scattered.refracted)
+        {
+          counters->refraction++;
+        }
+        else
+        {
+          counters->reflection++;
+        }
+
+        result += scattered.weight*color(scatteredRay, myScene, backgroundColor, depth+1, scatteredThroughput,
+                                         0, series, counters);
+      }
+    }
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): ka r g b kd r g b ks r g b, then any of
+//                   kr r g b, kt r g b, ior n, roughness r, bounces n
+//                 and alpha a at the end.
+void readMaterial(sceneReader *reader, materialParameters *material)
+{
+  std::string line;
+
+  material->ior = DEFAULT_IOR;
+
+  expectKeyword(reader, "ka");
+  readVector(reader, &material->ka);
+  expectKeyword(reader, "kd");
+  readVector(reader, &material->kd);
+  expectKeyword(reader, "ks");
+  readVector(reader, &material->ks);
+
+  bool ended = false;
+  while (!ended && expectToken(reader, &line, "'alpha'"))
+  {
+    if (line == "kr")
+    {
+      readVector(reader, &material->kr);
+    }
+    else if (line == "kt")
+    {
+      readVector(reader, &material->kt);
+    }
+    else if (line == "ior")
+    {
+      readNumber(reader, &material->ior);
+      if (!reader->failed && (material->ior <= 0.0f))
+      {
+        parseWarning(reader, "ior has to be positive");
+        material->ior = DEFAULT_IOR;
+      }
+    }
+    else if (line == "roughness")
+    {
+      readNumber(reader, &material->roughness);
+      if (!reader->failed && ((material->roughness < 0.0f) || (material->roughness > 1.0f)))
+      {
+        parseWarning(reader, "roughness has to be between 0 and 1");
+        material->roughness = min(max(material->roughness, 0.0f), 1.0f);
+      }
+    }
+    else if (line == "bounces")
+    {
+      readInteger(reader, &material->bounces);
+      if (!reader->failed && (material->bounces < 1))
+      {
+        parseWarning(reader, "bounces has to be at least 1");
+        material->bounces = 0;
+      }
+    }
+    else if (line == "alpha")
+    {
+      readNumber(reader, &material->alpha);
+      ended = true;
+    }
+    else
+    {
+      parseError(reader, "expected 'kr', 'kt', 'ior', 'roughness', 'bounces' or 'alpha', found '" + line + "'");
+    }
+  }
+}
+
+mesh readSphere(sceneReader *reader)
+{
+  mesh mySphere = {};
+  mySphere.type = sphere;
+
+  expectKeyword(reader, "center");
+  readVector(reader, &mySphere.center);
+  expectKeyword(reader, "radius");
+  readNumber(reader, &mySphere.radius);
+  if (!reader->failed && (mySphere.radius <= 0.0f))
+  {
+    parseWarning(reader, "the radius of a sphere has to be positive");
+  }
+  readMaterial(reader, &mySphere.material);
+
+  return(mySphere);
+}
+
+mesh readPlane(sceneReader *reader)
+{
+  mesh myPlane = {};
+  myPlane.type = plane;
+
+  expectKeyword(reader, "normal");
+  readVector(reader, &myPlane.normal);
+  if (!reader->failed && (length(myPlane.normal) == 0.0f))
+  {
+    parseWarning(reader, "the normal of a plane can't be 0");
+  }
+  myPlane.normal = normalize(myPlane.normal);
+  expectKeyword(reader, "p_0");
+  readVector(reader, &myPlane.p0);
+  readMaterial(reader, &myPlane.material);
+
+  return(myPlane);
+}
+
+mesh readTriangle(sceneReader *reader)
+{
+  mesh myTriangle = {};
+  myTriangle.type = triangle;
+
+  expectKeyword(reader, "a");
+  readVector(reader, &myTriangle.a);
+  expectKeyword(reader, "b");
+  readVector(reader, &myTriangle.b);
+  expectKeyword(reader, "c");
+  readVector(reader, &myTriangle.c);
+
+  vec3 ab = myTriangle.a - myTriangle.b;
+  vec3 ac = myTriangle.a - myTriangle.c;
+  if (!reader->failed && (length(crossProduct(ab, ac)) == 0.0f))
+  {
+    parseWarning(reader, "the triangle has no area");
+  }
+  myTriangle.normal = normalize(crossProduct(ab, ac));
+
+  readMaterial(reader, &myTriangle.material);
+
+  return(myTriangle);
+}
+
+// NOTE(ralntdir): The range is optional, it goes between the intensity
+// and the type. Area lights add their shape and the number of shadow
+// rays after the type:
+// type sphere: radius r samples n
+// type quad: edges u v samples n (u and v through the center)
+light readLight(sceneReader *reader)
+{
+  std::string line;
+  light myLight = {};
+  myLight.samples = 1;
+
+  expectKeyword(reader, "position");
+  readVector(reader, &myLight.position);
+  expectKeyword(reader, "intensity");
+  readVector(reader, &myLight.intensity);
+
+  if (expectToken(reader, &line, "'range' or 'type'"))
+  {
+    if (line == "range")
+    {
+      readNumber(reader, &myLight.range);
+      expectKeyword(reader, "type");
+    }
+    else if (line != "type")
+    {
+      parseError(reader, "expected 'range' or 'type', found '" + line + "'");
+    }
+  }
+
+  if (!expectToken(reader, &line, "a light type"))
+  {
+    return(myLight);
+  }
+
+  if (line.compare("point") == 0)
+  {
+    myLight.type = point;
+  }
+  else if (line.compare("directional") == 0)
+  {
+    myLight.type = directional;
+  }
+  else if (line.compare("sphere") == 0)
+  {
+    myLight.type = spherical;
+
+    expectKeyword(reader, "radius");
+    readNumber(reader, &myLight.radius);
+    expectKeyword(reader, "samples");
+    readInteger(reader, &myLight.samples);
+  }
+  else if (line.compare("quad") == 0)
+  {
+    myLight.type = quad;
+
+    expectKeyword(reader, "edges");
+    readVector(reader, &myLight.edgeU);
+    readVector(reader, &myLight.edgeV);
+    expectKeyword(reader, "samples");
+    readInteger(reader, &myLight.samples);
+
+    real32 cosine = dotProduct(normalize(myLight.edgeU), normalize(myLight.edgeV));
+    if (!reader->failed && (fabs(cosine) > 1e-3))
+    {
+      parseWarning(reader, "the edges of a quad light have to be perpendicular");
+    }
+  }
+  else
+  {
+    parseWarning(reader, "unknown light type '" + line + "', using a point light");
+  }
+
+  if (!reader->failed && (myLight.samples < 1))
+  {
+    parseWarning(reader, "a light needs at least 1 sample");
+    myLight.samples = 1;
+  }
+
+  return(myLight);
+}
+
+void addMesh(scene *myScene, mesh myMesh)
+{
+  myScene->meshes.push_back(myMesh);
+}
+
+int32 findObject(scene *myScene, std::string name)
+{
+  int32 result = -1;
+
+  for (int32 i = 0; i < (int32)myScene->objects.size(); i++)
+  {
+    if (myScene->objects[i].name == name)
+    {
+      result = i;
+      break;
+    }
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): After an unknown keyword the tokens are skipped, with
+// a single warning, until one that is known.
+void skipUnknown(sceneReader *reader, bool *skipping, const std::string &message)
+{
+  if (reader->strict)
+  {
+    parseError(reader, message);
+  }
+  else if (!*skipping)
+  {
+    parseWarning(reader, message + ", skipped up to the next keyword");
+  }
+  *skipping = true;
+}
+
+// NOTE(ralntdir): Big scene files are read in chunks, on all the
+// threads, before the file is read from the start as always. A chunk
+// can't know if it starts inside an object or a light, so it guesses:
+// it starts at its first sphere, plane, triangle or light and reads
+// those until its end or until anything else. When the reading from
+// the start gets to where a chunk started, between two statements, the
+// guess was right and it takes what the chunk read instead of reading
+// it again. A wrong guess, or a chunk with an error, is just read again.
+#define SCENE_CHUNK_SIZE (1 << 20)
+
+struct sceneChunk
+{
+  bool valid;
+
+  // NOTE(ralntdir): Where the first statement the chunk read starts,
+  // and where the reading goes on after the last one.
+  size_t start;
+  size_t stop;
+  int32 stopLine;
+  int32 stopColumn;
+
+  std::vector<mesh> meshes;
+  std::vector<light> lights;
+  std::string messages;
+  int32 warnings;
+};
+
+struct sceneChunks
+{
+  std::vector<sceneChunk> chunks;
+  // NOTE(ralntdir): The first one that hasn't been taken or passed.
+  size_t next;
+};
+
+bool isChunkStatement(sceneReader *reader)
+{
+  bool result = isToken(reader, "sphere") || isToken(reader, "plane") ||
+                isToken(reader, "triangle") || isToken(reader, "light");
+
+  return(result);
+}
+
+// NOTE(ralntdir): [begin, end) starts at the beginning of line.
+void readChunk(sceneChunk *chunk, const char *fileName, const std::string &text,
+               size_t begin, size_t end, int32 line, bool strict)
+{
+  sceneReader reader = {};
+  startSceneReader(&reader, fileName, text, strict);
+  reader.position = begin;
+  reader.line = line;
+  reader.messages = &chunk->messages;
+
+  // NOTE(ralntdir): The name of an object or the type of a light look
+  // like statements too.
+  bool found = false;
+  bool afterName = false;
+  while (!found && scanToken(&reader) && (reader.tokenStart < end))
+  {
+    found = !afterName && isChunkStatement(&reader);
+    afterName = isToken(&reader, "object") || isToken(&reader, "instance") || isToken(&reader, "type");
+  }
+
+  chunk->start = reader.tokenStart;
+  chunk->valid = found;
+
+  bool reading = found;
+  while (reading)
+  {
+    if (isToken(&reader, "sphere"))
+    {
+      chunk->meshes.push_back(readSphere(&reader));
+    }
+    else if (isToken(&reader, "plane"))
+    {
+      chunk->meshes.push_back(readPlane(&reader));
+    }
+    else if (isToken(&reader, "triangle"))
+    {
+      chunk->meshes.push_back(readTriangle(&reader));
+    }
+    else
+    {
+      chunk->lights.push_back(readLight(&reader));
+    }
+
+    reading = !reader.failed && scanToken(&reader) && (reader.tokenStart < end) && isChunkStatement(&reader);
+  }
+
+  // NOTE(ralntdir): At the end of the file the token is empty and it
+  // starts there.
+  chunk->valid = found && !reader.failed;
+  chunk->stop = reader.tokenStart;
+  chunk->stopLine = reader.tokenLine;
+  chunk->stopColumn = reader.tokenColumn;
+  chunk->warnings = reader.warnings;
+}
+
+void readChunks(sceneChunks *chunks, const char *fileName, const std::string &text, bool strict)
+{
+  int32 count = (int32)(text.size()/SCENE_CHUNK_SIZE);
+
+  chunks->chunks.clear();
+  chunks->next = 0;
+
+  // NOTE(ralntdir): Small files are only read from the start.
+  if (count < 2)
+  {
+    return;
+  }
+
+  chunks->chunks.resize(count);
+
+  // NOTE(ralntdir): Every chunk starts at the beginning of a line, a
+  // token or a comment never goes from one chunk to the next.
+  std::vector<size_t> begins(count + 1);
+  std::vector<int32> lines(count + 1);
+  begins[0] = 0;
+  begins[count] = text.size();
+  for (int32 i = 1; i < count; i++)
+  {
+    size_t newline = text.find('\n', (size_t)i*SCENE_CHUNK_SIZE);
+    begins[i] = (newline == std::string::npos) ? text.size() : newline + 1;
+  }
+
+  #pragma omp parallel for
+  for (int32 i = 0; i < count; i++)
+  {
+    lines[i + 1] = (int32)std::count(text.begin() + begins[i], text.begin() + begins[i + 1], '\n');
+  }
+  lines[0] = 1;
+  for (int32 i = 1; i <= count; i++)
+  {
+    lines[i] += lines[i - 1];
+  }
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int32 i = 0; i < count; i++)
+  {
+    if (begins[i] < begins[i + 1])
+    {
+      readChunk(&chunks->chunks[i], fileName, text, begins[i], begins[i + 1], lines[i], strict);
+    }
+  }
+}
+
+// NOTE(ralntdir): Takes the chunks that start right where the reader is,
+// if any. Inside an object lights is 0, and chunks with lights aren't
+// taken there. Returns true if it took one.
+bool takeChunks(sceneReader *reader, sceneChunks *chunks, std::vector<mesh> *meshes, std::vector<light> *lights)
+{
+  bool result = false;
+  bool taking = !reader->failed;
+
+  while (taking)
+  {
+    skipSpace(reader);
+
+    while ((chunks->next < chunks->chunks.size()) &&
+           (!chunks->chunks[chunks->next].valid || (chunks->chunks[chunks->next].start < reader->position)))
+    {
+      chunks->next++;
+    }
+
+    taking = (chunks->next < chunks->chunks.size());
+    if (taking)
+    {
+      sceneChunk *chunk = &chunks->chunks[chunks->next];
+      taking = (chunk->start == reader->position) && (lights || chunk->lights.empty());
+
+      if (taking)
+      {
+        meshes->insert(meshes->end(), chunk->meshes.begin(), chunk->meshes.end());
+        if (lights)
+        {
+          lights->insert(lights->end(), chunk->lights.begin(), chunk->lights.end());
+        }
+        std::cout << chunk->messages;
+        reader->warnings += chunk->warnings;
+        std::vector<mesh>().swap(chunk->meshes);
+
+        reader->position = chunk->stop;
+        reader->line = chunk->stopLine;
+        reader->column = chunk->stopColumn;
+
+        chunks->next++;
+        result = true;
+      }
+    }
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): object name
+//                 (sphere|plane|triangle blocks, in object space)
+//                 end
+void readObject(scene *myScene, sceneReader *reader, sceneChunks *chunks)
+{
+  std::string line;
+  object myObject = {};
+  bool skipping = false;
+  bool ended = false;
+
+  expectToken(reader, &myObject.name, "the name of the object");
+
+  if (takeChunks(reader, chunks, &myObject.meshes, 0))
+  {
+    skipping = false;
+  }
+
+  while (!ended && nextToken(reader, &line))
+  {
+    if (line == "end")
+    {
+      ended = true;
+    }
+    else if (line == "sphere")
+    {
+      myObject.meshes.push_back(readSphere(reader));
+      skipping = false;
+    }
+    else if (line == "plane")
+    {
+      myObject.meshes.push_back(readPlane(reader));
+      skipping = false;
+    }
+    else if (line == "triangle")
+    {
+      myObject.meshes.push_back(readTriangle(reader));
+      skipping = false;
+    }
+    else
+    {
+      skipUnknown(reader, &skipping, "unknown mesh '" + line + "' in object " + myObject.name);
+    }
+
+    if (!ended && takeChunks(reader, chunks, &myObject.meshes, 0))
+    {
+      skipping = false;
+    }
+  }
+
+  if (!ended)
+  {
+    parseError(reader, "expected 'end' of object " + myObject.name + ", found the end of the file");
+    return;
+  }
+
+  int32 index = findObject(myScene, myObject.name);
+  if (index == -1)
+  {
+    myScene->objects.push_back(myObject);
+  }
+  else
+  {
+    parseWarning(reader, "object " + myObject.name + " defined twice, using the last one");
+    myScene->objects[index] = myObject;
+  }
+}
+
+// NOTE(ralntdir): instance name
+//                 translate x y z | rotate x y z degrees | scale x y z
+//                 (applied in the order they are written)
+//                 material (ka, kd, ks ... alpha as in a mesh), optional
+//                 end
+void readInstance(scene *myScene, sceneReader *reader)
+{
+  std::string line;
+  std::string name;
+  instance myInstance = {};
+  myInstance.objectToWorld = identity();
+  bool skipping = false;
+  bool ended = false;
+
+  expectToken(reader, &name, "the name of an object");
+
+  // NOTE(ralntdir): Where the instance starts, for the message if the
+  // object doesn't exist.
+  int32 nameLine = reader->tokenLine;
+  int32 nameColumn = reader->tokenColumn;
+
+  while (!ended && nextToken(reader, &line))
+  {
+    if (line == "end")
+    {
+      ended = true;
+    }
+    else if (line == "translate")
+    {
+      vec3 offset = {};
+      readVector(reader, &offset);
+      myInstance.objectToWorld = translation(offset)*myInstance.objectToWorld;
+      skipping = false;
+    }
+    else if (line == "rotate")
+    {
+      vec3 axis = {};
+      real32 degrees = 0.0;
+      readVector(reader, &axis);
+      readNumber(reader, &degrees);
+      myInstance.objectToWorld = rotation(axis, degrees)*myInstance.objectToWorld;
+      skipping = false;
+    }
+    else if (line == "scale")
+    {
+      vec3 factors = {};
+      readVector(reader, &factors);
+      myInstance.objectToWorld = scaling(factors)*myInstance.objectToWorld;
+      skipping = false;
+    }
+    else if (line == "material")
+    {
+      myInstance.overrideMaterial = true;
+      readMaterial(reader, &myInstance.material);
+      skipping = false;
+    }
+    else
+    {
+      skipUnknown(reader, &skipping, "unknown instance parameter '" + line + "'");
+    }
+  }
+
+  if (!ended)
+  {
+    parseError(reader, "expected 'end' of the instance of " + name + ", found the end of the file");
+    return;
+  }
+
+  myInstance.objectIndex = findObject(myScene, name);
+  myInstance.worldToObject = affineInverse(myInstance.objectToWorld);
+
+  if (myInstance.objectIndex == -1)
+  {
+    reader->tokenLine = nameLine;
+    reader->tokenColumn = nameColumn;
+    parseWarning(reader, "instance of an unknown object " + name + ", objects have to be defined first");
+  }
+  else
+  {
+    myScene->instances.push_back(myInstance);
+  }
+}
+
+// NOTE(ralntdir): Returns false if the file can't be read or has an
+// error (or a warning in strict mode), what was read until then is left
+// in the scene. times gets how long reading the file and parsing it
+// took, if it isn't 0.
+bool readSceneFile(scene *myScene, const char *filename, bool strict, startupTimes *times)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  std::string text;
+  if (!readTextFile(filename, &text))
+  {
+    std::cout << "There was a problem opening the scene file " << filename << "\n";
+    return(false);
+  }
+
+  std::chrono::steady_clock::time_point parseStart = std::chrono::steady_clock::now();
+
+  sceneChunks chunks = {};
+  readChunks(&chunks, filename, text, strict);
+
+  size_t chunkMeshes = 0;
+  for (size_t i = 0; i < chunks.chunks.size(); i++)
+  {
+    chunkMeshes += chunks.chunks[i].meshes.size();
+  }
+  myScene->meshes.reserve(chunkMeshes);
+
+  sceneReader reader = {};
+  startSceneReader(&reader, filename, text, strict);
+
+  myScene->view = defaultCamera();
+
+  std::string line;
+  bool skipping = false;
+
+  takeChunks(&reader, &chunks, &myScene->meshes, &myScene->lights);
+
+  while (nextToken(&reader, &line))
+  {
+    bool known = true;
+
+    if (line == "camera")
+    {
+      readVector(&reader, &myScene->view.position);
+    }
+    else if (line == "lookAt")
+    {
+      readVector(&reader, &myScene->view.lookAt);
+      myScene->view.aimed = true;
+    }
+    else if (line == "up")
+    {
+      readVector(&reader, &myScene->view.up);
+    }
+    else if (line == "fov")
+    {
+      readNumber(&reader, &myScene->view.fov);
+    }
+    else if (line == "aperture")
+    {
+      readNumber(&reader, &myScene->view.aperture);
+    }
+    else if (line == "focus")
+    {
+      readNumber(&reader, &myScene->view.focusDistance);
+    }
+    else if (line == "sphere")
+    {
+      addMesh(myScene, readSphere(&reader));
+    }
+    else if (line == "plane")
+    {
+      addMesh(myScene, readPlane(&reader));
+    }
+    else if (line == "triangle")
+    {
+      addMesh(myScene, readTriangle(&reader));
+    }
+    else if (line == "object")
+    {
+      readObject(myScene, &reader, &chunks);
+    }
+    else if (line == "instance")
+    {
+      readInstance(myScene, &reader);
+    }
+    else if (line == "light")
+    {
+      myScene->lights.push_back(readLight(&reader));
+    }
+    else if (line == "ul")
+    {
+      readVector(&reader, &myScene->view.ul);
+    }
+    else if (line == "ur")
+    {
+      readVector(&reader, &myScene->view.ur);
+    }
+    else if (line == "lr")
+    {
+      readVector(&reader, &myScene->view.lr);
+    }
+    else if (line == "ll")
+    {
+      readVector(&reader, &myScene->view.ll);
+    }
+    else
+    {
+      skipUnknown(&reader, &skipping, "unknown keyword '" + line + "'");
+      known = false;
+    }
+
+    if (known)
+    {
+      skipping = false;
+    }
+
+    if (takeChunks(&reader, &chunks, &myScene->meshes, &myScene->lights))
+    {
+      skipping = false;
+    }
+  }
+
+  bool result = !reader.failed;
+
+  if (times)
+  {
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    times->readMilliseconds = std::chrono::duration<real64, std::milli>(parseStart - start).count();
+    times->parseMilliseconds = std::chrono::duration<real64, std::milli>(end - parseStart).count();
+    times->chunks = (int32)chunks.chunks.size();
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): The part of the image plane some points land on, in
+// the u, v of the camera. A point can also be at infinity, in a
+// direction: it lands where all the lines along that direction meet on
+// the image (its vanishing point).
+struct screenExtent
+{
+  real32 minU;
+  real32 minV;
+  real32 maxU;
+  real32 maxV;
+  real32 maxBlur;
+
+  // NOTE(ralntdir): Some point was behind the camera or beside it.
+  bool whole;
+};
+
+screenExtent emptyScreenExtent()
+{
+  screenExtent result = {};
+
+  result.minU = FLT_MAX;
+  result.minV = FLT_MAX;
+  result.maxU = -FLT_MAX;
+  result.maxV = -FLT_MAX;
+
+  return(result);
+}
+
+// NOTE(ralntdir): The image plane (lowerLeft L, horizontal H, vertical
+// V) is relative to the camera, a point p is at u, v on it when
+// L + u*H + v*V = s*(p - camera) for some s > 0.
+void addScreenPoint(screenExtent *extent, camera *view, vec3 p, bool atInfinity)
+{
+  vec3 horizontalOffset = view->horizontal;
+  vec3 verticalOffset = view->vertical;
+  real32 det = scalarTripleProduct(horizontalOffset, verticalOffset, view->lowerLeft);
+  vec3 d = atInfinity ? p : (p - view->position);
+
+  // NOTE(ralntdir): Cramer's rule on [H V -d](u v s) = -L, with
+  // 1/s instead of s, which is infinite for points beside the camera.
+  real32 invS = scalarTripleProduct(horizontalOffset, verticalOffset, d)/det;
+  if (invS <= 0.0f)
+  {
+    extent->whole = true;
+  }
+  else
+  {
+    real32 u = -scalarTripleProduct(view->lowerLeft, verticalOffset, d)/(det*invS);
+    real32 v = -scalarTripleProduct(horizontalOffset, view->lowerLeft, d)/(det*invS);
+
+    extent->minU = min(extent->minU, u);
+    extent->minV = min(extent->minV, v);
+    extent->maxU = max(extent->maxU, u);
+    extent->maxV = max(extent->maxV, v);
+
+    // NOTE(ralntdir): Seen from a point e of the lens, p lands on the
+    // image plane (which is at the focus distance) at p/s + e*(1 - 1/s).
+    // 1/s is 0 at infinity.
+    extent->maxBlur = max(extent->maxBlur, atInfinity ? 1.0f : (real32)fabs(1.0f - invS));
+  }
+}
+
+imageRegion screenRegion(screenExtent extent, camera *view, int32 width, int32 height)
+{
+  imageRegion result = fullRegion(width, height);
+
+  if (extent.whole)
+  {
+    return(result);
+  }
+
+  if (view->thinLens)
+  {
+    real32 lensRadius = length(view->lensU);
+    real32 blurU = lensRadius*extent.maxBlur/length(view->horizontal);
+    real32 blurV = lensRadius*extent.maxBlur/length(view->vertical);
+
+    extent.minU -= blurU;
+    extent.maxU += blurU;
+    extent.minV -= blurV;
+    extent.maxV += blurV;
+  }
+
+  // NOTE(ralntdir): v goes up and the rows go down. One pixel more on
+  // each side for the pixels the points only touch.
+  imageRegion covered = {};
+  covered.minX = (int32)floor(min(max(extent.minU, -1.0f), 2.0f)*width) - 1;
+  covered.maxX = (int32)ceil(min(max(extent.maxU, -1.0f), 2.0f)*width) + 1;
+  covered.minY = (int32)floor((1.0f - min(max(extent.maxV, -1.0f), 2.0f))*height) - 1;
+  covered.maxY = (int32)ceil((1.0f - min(max(extent.minV, -1.0f), 2.0f))*height) + 1;
+
+  result = intersect(covered, result);
+
+  return(result);
+}
+
+// NOTE(ralntdir): The pixels a box covers on the screen. A box that
+// reaches behind the camera covers the whole screen.
+imageRegion screenBounds(scene *myScene, aabb box, int32 width, int32 height)
+{
+  imageRegion result = {};
+
+  if (isEmpty(box))
+  {
+    return(result);
+  }
+  if (isInfinite(box))
+  {
+    result = fullRegion(width, height);
+    return(result);
+  }
+
+  screenExtent extent = emptyScreenExtent();
+  for (int32 corner = 0; corner < 8; corner++)
+  {
+    addScreenPoint(&extent, &myScene->view, boxCorner(box, corner), false);
+  }
+
+  result = screenRegion(extent, &myScene->view, width, height);
+
+  return(result);
+}
+
+// NOTE(ralntdir): Where the shadow that a box casts from myLight can fall
+// on the screen, inside sceneBox (where there is something to fall on).
+//
+// The shadow is every point p = l + t*(b - l), t >= 1, for l on the light
+// and b in the box, which is inside the hull of the corners of the box
+// and of the same corners pushed away from each corner of the light.
+// They are pushed to t = T, the farthest any point of sceneBox can be:
+// |p - l| = t*|b - l| can't be more than the longest distance from the
+// light to sceneBox, and |b - l| isn't less than the shortest one to the
+// box. An infinite sceneBox (a plane) takes them to infinity instead, in
+// the direction b - l. A directional light is a light at infinity, b - l
+// is always its direction.
+imageRegion shadowScreenBounds(scene *myScene, aabb box, light *myLight, aabb sceneBox,
+                               int32 width, int32 height)
+{
+  imageRegion result = {};
+
+  // NOTE(ralntdir): Nothing is lit past the range of a light, neither
+  // are there shadows.
+  aabb lightBox = lightBounds(myLight);
+  if (myLight->range > 0.0f)
+  {
+    vec3 range = { myLight->range, myLight->range, myLight->range };
+    aabb reached = { lightBox.min - range, lightBox.max + range };
+    sceneBox = intersect(sceneBox, reached);
+  }
+
+  if (isEmpty(box) || isEmpty(sceneBox))
+  {
+    return(result);
+  }
+
+  if (isInfinite(box))
+  {
+    result = fullRegion(width, height);
+    return(result);
+  }
+
+  camera *view = &myScene->view;
+  bool atInfinity = isInfinite(sceneBox);
+  screenExtent extent = emptyScreenExtent();
+
+  for (int32 corner = 0; corner < 8; corner++)
+  {
+    addScreenPoint(&extent, view, boxCorner(box, corner), false);
+  }
+
+  if (myLight->type == directional)
+  {
+    real32 T = atInfinity ? 1.0f : maxDistance(sceneBox, sceneBox)/length(myLight->position);
+    for (int32 corner = 0; corner < 8; corner++)
+    {
+      vec3 b = boxCorner(box, corner);
+      addScreenPoint(&extent, view, atInfinity ? myLight->position : (b + T*myLight->position), atInfinity);
+    }
+  }
+  else
+  {
+    // NOTE(ralntdir): A light that touches the box can shadow anything.
+    real32 closest = minDistance(lightBox, box);
+    if (closest == 0.0f)
+    {
+      result = screenBounds(myScene, sceneBox, width, height);
+      return(result);
+    }
+
+    real32 T = atInfinity ? 1.0f : maxDistance(lightBox, sceneBox)/closest;
+    for (int32 lightCorner = 0; lightCorner < 8; lightCorner++)
+    {
+      vec3 l = boxCorner(lightBox, lightCorner);
+      for (int32 corner = 0; corner < 8; corner++)
+      {
+        vec3 b = boxCorner(box, corner);
+        addScreenPoint(&extent, view, atInfinity ? (b - l) : (l + T*(b - l)), atInfinity);
+      }
+    }
+  }
+
+  result = intersect(screenRegion(extent, view, width, height),
+                     screenBounds(myScene, sceneBox, width, height));
+
+  return(result);
+}
+
+// NOTE(ralntdir): The box an instance takes in the world.
+aabb instanceBounds(scene *myScene, instance *myInstance)
+{
+  object *myObject = &myScene->objects[myInstance->objectIndex];
+  aabb result = transformBounds(myInstance->objectToWorld, myObject->bounds);
+
+  return(result);
+}
+
+imageRegion instanceScreenBounds(scene *myScene, instance *myInstance, int32 width, int32 height)
+{
+  imageRegion result = screenBounds(myScene, instanceBounds(myScene, myInstance), width, height);
+
+  return(result);
+}
+
+// NOTE(ralntdir): All the instances of the object, empty if it has none
+// or they are off screen.
+imageRegion objectScreenBounds(scene *myScene, int32 objectIndex, int32 width, int32 height)
+{
+  imageRegion result = {};
+
+  for (size_t i = 0; i < myScene->instances.size(); i++)
+  {
+    instance *myInstance = &myScene->instances[i];
+    if (myInstance->objectIndex == objectIndex)
+    {
+      result = grow(result, instanceScreenBounds(myScene, myInstance, width, height));
+    }
+  }
+
+  return(result);
+}
+
+inline bool sameVector(vec3 a, vec3 b)
+{
+  bool result = (a.x == b.x) && (a.y == b.y) && (a.z == b.z);
+
+  return(result);
+}
+
+bool sameMaterial(materialParameters *a, materialParameters *b)
+{
+  bool result = sameVector(a->ka, b->ka) && sameVector(a->kd, b->kd) &&
+                sameVector(a->ks, b->ks) && sameVector(a->kr, b->kr) &&
+                sameVector(a->kt, b->kt) && (a->ior == b->ior) && (a->roughness == b->roughness) &&
+                (a->bounces == b->bounces) && (a->alpha == b->alpha);
+
+  return(result);
+}
+
+bool sameGeometry(mesh *a, mesh *b)
+{
+  bool result = (a->type == b->type);
+
+  if (result && (a->type == sphere))
+  {
+    result = sameVector(a->center, b->center) && (a->radius == b->radius);
+  }
+  else if (result && (a->type == plane))
+  {
+    result = sameVector(a->normal, b->normal) && sameVector(a->p0, b->p0);
+  }
+  else if (result && (a->type == triangle))
+  {
+    result = sameVector(a->a, b->a) && sameVector(a->b, b->b) && sameVector(a->c, b->c);
+  }
+
+  return(result);
+}
+
+bool sameMesh(mesh *a, mesh *b)
+{
+  bool result = sameGeometry(a, b) && sameMaterial(&a->material, &b->material);
+
+  return(result);
+}
+
+bool sameObject(object *a, object *b)
+{
+  bool result = (a->name == b->name) && (a->meshes.size() == b->meshes.size());
+
+  for (size_t i = 0; result && (i < a->meshes.size()); i++)
+  {
+    result = sameMesh(&a->meshes[i], &b->meshes[i]);
+  }
+
+  return(result);
+}
+
+bool samePlacement(instance *a, instance *b)
+{
+  bool result = (a->objectIndex == b->objectIndex) &&
+                (memcmp(&a->objectToWorld, &b->objectToWorld, sizeof(mat4)) == 0);
+
+  return(result);
+}
+
+bool sameInstanceMaterial(instance *a, instance *b)
+{
+  bool result = (a->overrideMaterial == b->overrideMaterial);
+
+  if (result && a->overrideMaterial)
+  {
+    result = sameMaterial(&a->material, &b->material);
+  }
+
+  return(result);
+}
+
+bool sameInstance(instance *a, instance *b)
+{
+  bool result = samePlacement(a, b) && sameInstanceMaterial(a, b);
+
+  return(result);
+}
+
+// NOTE(ralntdir): Compares the rays they make, not how they were placed.
+bool sameCamera(camera *a, camera *b)
+{
+  bool result = sameVector(a->position, b->position) &&
+                sameVector(a->lowerLeft, b->lowerLeft) &&
+                sameVector(a->horizontal, b->horizontal) &&
+                sameVector(a->vertical, b->vertical) &&
+                sameVector(a->lensU, b->lensU) &&
+                sameVector(a->lensV, b->lensV);
+
+  return(result);
+}
+
+bool sameLight(light *a, light *b)
+{
+  bool result = (a->type == b->type) &&
+                sameVector(a->position, b->position) &&
+                sameVector(a->intensity, b->intensity) &&
+                (a->range == b->range) &&
+                (a->radius == b->radius) &&
+                sameVector(a->edgeU, b->edgeU) &&
+                sameVector(a->edgeV, b->edgeV) &&
+                (a->samples == b->samples);
+
+  return(result);
+}
+
+// NOTE(ralntdir): If some hit in the scene can send a reflection or a
+// refraction ray.
+bool hasSecondaryRays(scene *myScene)
+{
+  bool result = false;
+
+  for (size_t i = 0; !result && (i < myScene->meshes.size()); i++)
+  {
+    result = scattersLight(&myScene->meshes[i].material);
+  }
+  for (size_t i = 0; !result && (i < myScene->objects.size()); i++)
+  {
+    std::vector<mesh> &meshes = myScene->objects[i].meshes;
+    for (size_t j = 0; !result && (j < meshes.size()); j++)
+    {
+      result = scattersLight(&meshes[j].material);
+    }
+  }
+  for (size_t i = 0; !result && (i < myScene->instances.size()); i++)
+  {
+    instance *myInstance = &myScene->instances[i];
+    result = myInstance->overrideMaterial && scattersLight(&myInstance->material);
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): Where the image changes between two versions of a
+// scene: the screen bounds of the old and the new version of every mesh
+// and instance that changed, and of the shadows that the ones that moved
+// cast (see shadowScreenBounds()). Returns true when everything changes
+// (the camera or a light). Meshes, objects and instances are matched by
+// their position in the file.
+//
+// A mesh also shows through the reflections and refractions of other
+// meshes, which have no bounds that are cheap to find, so in a scene with
+// mirrors or glass any change returns true too. Shadow rays don't look at
+// materials, a change of material only shows through the secondary rays.
+bool findChangedRegions(scene *before, scene *after, int32 width, int32 height,
+                        std::vector<imageRegion> *regions)
+{
+  bool result = !sameCamera(&before->view, &after->view) ||
+                (before->lightSamples != after->lightSamples) ||
+                (before->lights.size() != after->lights.size());
+
+  for (size_t i = 0; !result && (i < before->lights.size()); i++)
+  {
+    result = !sameLight(&before->lights[i], &after->lights[i]);
+  }
+
+  if (result)
+  {
+    return(result);
+  }
+
+  // NOTE(ralntdir): A scene that was just read doesn't have the bounds
+  // of its objects yet.
+  std::vector<aabb> meshBoxes;
+  for (size_t i = 0; i < after->objects.size(); i++)
+  {
+    objectMeshBounds(&after->objects[i], &meshBoxes);
+  }
+
+  // NOTE(ralntdir): The old and the new bounds of everything that moved.
+  std::vector<aabb> moved;
+
+  size_t numMeshes = before->meshes.size();
+  if (after->meshes.size() > numMeshes)
+  {
+    numMeshes = after->meshes.size();
+  }
+  for (size_t i = 0; i < numMeshes; i++)
+  {
+    bool inBefore = i < before->meshes.size();
+    bool inAfter = i < after->meshes.size();
+
+    if (inBefore && inAfter && sameMesh(&before->meshes[i], &after->meshes[i]))
+    {
+      continue;
+    }
+    bool geometryChanged = !inBefore || !inAfter || !sameGeometry(&before->meshes[i], &after->meshes[i]);
+
+    if (inBefore)
+    {
+      aabb box = meshBounds(&before->meshes[i]);
+      regions->push_back(screenBounds(before, box, width, height));
+      if (geometryChanged)
+      {
+        moved.push_back(box);
+      }
+    }
+    if (inAfter)
+    {
+      aabb box = meshBounds(&after->meshes[i]);
+      regions->push_back(screenBounds(after, box, width, height));
+      if (geometryChanged)
+      {
+        moved.push_back(box);
+      }
+    }
+  }
+
+  std::vector<bool> objectChanged(after->objects.size());
+  std::vector<bool> objectMoved(after->objects.size());
+  for (size_t i = 0; i < after->objects.size(); i++)
+  {
+    objectChanged[i] = (i >= before->objects.size()) || !sameObject(&before->objects[i], &after->objects[i]);
+    objectMoved[i] = (i >= before->objects.size()) ||
+                     (before->objects[i].meshes.size() != after->objects[i].meshes.size());
+
+    for (size_t j = 0; !objectMoved[i] && (j < after->objects[i].meshes.size()); j++)
+    {
+      objectMoved[i] = !sameGeometry(&before->objects[i].meshes[j], &after->objects[i].meshes[j]);
+    }
+  }
+
+  size_t numInstances = before->instances.size();
+  if (after->instances.size() > numInstances)
+  {
+    numInstances = after->instances.size();
+  }
+  for (size_t i = 0; i < numInstances; i++)
+  {
+    bool inBefore = i < before->instances.size();
+    bool inAfter = i < after->instances.size();
+
+    if (inBefore && inAfter &&
+        sameInstance(&before->instances[i], &after->instances[i]) &&
+        !objectChanged[after->instances[i].objectIndex])
+    {
+      continue;
+    }
+    bool geometryChanged = !inBefore || !inAfter ||
+                           !samePlacement(&before->instances[i], &after->instances[i]) ||
+                           objectMoved[after->instances[i].objectIndex];
+
+    if (inBefore)
+    {
+      aabb box = instanceBounds(before, &before->instances[i]);
+      regions->push_back(screenBounds(before, box, width, height));
+      if (geometryChanged)
+      {
+        moved.push_back(box);
+      }
+    }
+    if (inAfter)
+    {
+      aabb box = instanceBounds(after, &after->instances[i]);
+      regions->push_back(screenBounds(after, box, width, height));
+      if (geometryChanged)
+      {
+        moved.push_back(box);
+      }
+    }
+  }
+
+  if (!regions->empty() && (hasSecondaryRays(before) || hasSecondaryRays(after)))
+  {
+    result = true;
+  }
+  else if (!moved.empty() && !after->lights.empty())
+  {
+    // NOTE(ralntdir): Shadows only fall on something, in either version.
+    std::vector<aabb> boxes;
+    aabb sceneBox = emptyBounds();
+    topLevelBounds(before, &boxes);
+    for (size_t i = 0; i < boxes.size(); i++)
+    {
+      sceneBox = grow(sceneBox, boxes[i]);
+    }
+    topLevelBounds(after, &boxes);
+    for (size_t i = 0; i < boxes.size(); i++)
+    {
+      sceneBox = grow(sceneBox, boxes[i]);
+    }
+
+    for (size_t i = 0; i < after->lights.size(); i++)
+    {
+      for (size_t j = 0; j < moved.size(); j++)
+      {
+        regions->push_back(shadowScreenBounds(after, moved[j], &after->lights[i], sceneBox, width, height));
+      }
+    }
+  }
+
+  return(result);
+}
+
+struct sceneUpdate
+{
+  bool rebuilt;
+  int32 materials;
+  int32 geometry;
+  int32 lights;
+};
+
+// NOTE(ralntdir): Same number of meshes, objects (with the same number
+// of meshes each) and instances, so everything can be updated where it
+// is and the trees keep their shape.
+bool sameStructure(scene *a, scene *b)
+{
+  bool result = (a->meshes.size() == b->meshes.size()) &&
+                (a->objects.size() == b->objects.size()) &&
+                (a->instances.size() == b->instances.size());
+
+  for (size_t i = 0; result && (i < a->objects.size()); i++)
+  {
+    result = (a->objects[i].meshes.size() == b->objects[i].meshes.size());
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): Copies what changed in meshes (updated) over current.
+// Returns how many meshes moved and counts the ones that only changed
+// their material in update.
+int32 updateMeshes(std::vector<mesh> &current, std::vector<mesh> &updated, sceneUpdate *update)
+{
+  int32 result = 0;
+
+  for (size_t i = 0; i < current.size(); i++)
+  {
+    if (!sameGeometry(&current[i], &updated[i]))
+    {
+      current[i] = updated[i];
+      result++;
+    }
+    else if (!sameMaterial(&current[i].material, &updated[i].material))
+    {
+      current[i].material = updated[i].material;
+      update->materials++;
+    }
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): Brings myScene to newScene (an unbuilt scene, just
+// read from the file) doing as little as possible: materials are copied
+// in place, trees over moved geometry are refitted and the light tree is
+// only built again if the lights changed. If things were added or
+// removed, newScene is built and replaces myScene.
+sceneUpdate updateScene(scene *myScene, scene *newScene)
+{
+  sceneUpdate result = {};
+
+  if (!sameStructure(myScene, newScene))
+  {
+    buildAccelerationStructures(newScene, false, 0);
+    // NOTE(ralntdir): The ray counters are of every render so far, a new
+    // structure doesn't start them again.
+    newScene->rays = myScene->rays;
+    *myScene = *newScene;
+    result.rebuilt = true;
+
+    return(result);
+  }
+
+  myScene->view = newScene->view;
+
+  bool lightsChanged = (myScene->lights.size() != newScene->lights.size());
+  for (size_t i = 0; !lightsChanged && (i < myScene->lights.size()); i++)
+  {
+    lightsChanged = !sameLight(&myScene->lights[i], &newScene->lights[i]);
+  }
+  if (lightsChanged)
+  {
+    myScene->lights = newScene->lights;
+    buildLightTree(&myScene->lightHierarchy, myScene->lights);
+    result.lights = (int32)myScene->lights.size();
+  }
+  myScene->lightSamples = newScene->lightSamples;
+
+  int32 moved = updateMeshes(myScene->meshes, newScene->meshes, &result);
+
+  std::vector<aabb> bounds;
+  for (size_t i = 0; i < myScene->objects.size(); i++)
+  {
+    object *myObject = &myScene->objects[i];
+    object *newObject = &newScene->objects[i];
+    myObject->name = newObject->name;
+
+    int32 objectMoved = updateMeshes(myObject->meshes, newObject->meshes, &result);
+    if (objectMoved)
+    {
+      objectMeshBounds(myObject, &bounds);
+      updateBVH(&myObject->tree, bounds);
+      moved += objectMoved;
+    }
+  }
+
+  for (size_t i = 0; i < myScene->instances.size(); i++)
+  {
+    instance *myInstance = &myScene->instances[i];
+    instance *newInstance = &newScene->instances[i];
+
+    if (!samePlacement(myInstance, newInstance))
+    {
+      myInstance->objectIndex = newInstance->objectIndex;
+      myInstance->objectToWorld = newInstance->objectToWorld;
+      myInstance->worldToObject = newInstance->worldToObject;
+      moved++;
+    }
+    if (!sameInstanceMaterial(myInstance, newInstance))
+    {
+      myInstance->overrideMaterial = newInstance->overrideMaterial;
+      myInstance->material = newInstance->material;
+      result.materials++;
+    }
+  }
+
+  // NOTE(ralntdir): A moved mesh inside an object changes the bounds of
+  // its instances, so any movement refits the top level.
+  if (moved)
+  {
+    topLevelBounds(myScene, &bounds);
+    updateBVH(&myScene->topLevel, bounds);
+  }
+  result.geometry = moved;
+
+  return(result);
+}
+
+// NOTE(ralntdir): Grown out to whole tiles.
+imageRegion snapToTiles(imageRegion region, int32 width, int32 height)
+{
+  imageRegion result = region;
+
+  if (!isEmpty(region))
+  {
+    result.minX = (region.minX/TILE_SIZE)*TILE_SIZE;
+    result.minY = (region.minY/TILE_SIZE)*TILE_SIZE;
+    result.maxX = ((region.maxX + TILE_SIZE - 1)/TILE_SIZE)*TILE_SIZE;
+    result.maxY = ((region.maxY + TILE_SIZE - 1)/TILE_SIZE)*TILE_SIZE;
+    result = intersect(result, fullRegion(width, height));
+  }
+
+  return(result);
+}
+
+struct renderOptions
+{
+  char *sceneFileName;
+
+  // NOTE(ralntdir): If set, no rays are traced, the HDR image is read
+  // back from this file and only the post-processing is redone.
+  char *hdrInputFileName;
+  const char *hdrOutputFileName;
+  const char *imageFileName;
+
+  // NOTE(ralntdir): If set, the image is rendered a tile at a time into
+  // this tiled HDR file, and only the tiles being rendered are kept in
+  // memory. There is no .pfm, .ppm or window then.
+  const char *tiledOutputFileName;
+
+  int32 width;
+  int32 height;
+  int32 samples;
+  uint64 seed;
+
+  // NOTE(ralntdir): -1 picks depending on the number of lights.
+  int32 lightSamples;
+
+  const char *checkpointFileName;
+  real64 checkpointInterval;
+  bool resume;
+
+  tonemapSettings tonemap;
+
+  bool denoise;
+  denoiseSettings denoiser;
+
+  bool bvhStats;
+  bool stats;
+  bool strict;
+
+  // NOTE(ralntdir): Only these pixels are rendered, the full image if
+  // none of the crop options is given.
+  bool crop;
+  imageRegion cropRegion;
+  const char *cropObjectName;
+
+  // NOTE(ralntdir): Keeps the window open, and renders again the parts
+  // of the image that change when the scene file is saved.
+  bool interactive;
+
+  // NOTE(ralntdir): Never opens a window, for machines without a display.
+  bool headless;
+  // NOTE(ralntdir): 0 uses all of them.
+  int32 threads;
+
+  // NOTE(ralntdir): If set, nothing is rendered, the second HDR image is
+  // compared with the first one, the reference.
+  const char *compareFileNames[2];
+  real32 absoluteTolerance;
+  real32 relativeTolerance;
+};
+
+void printUsage()
+{
+  std::cout << "Usage: ./program sceneFile [options]\n"
+            << "       ./program --from-hdr image.pfm [options]\n"
+            << "Options:\n"
+            << "  --size width height     of the image (default " << WIDTH << " " << HEIGHT << ")\n"
+            << "  --spp samples           samples per pixel (default " << MAX_SAMPLES << ")\n"
+            << "  --seed n                seed for the random numbers (default 0)\n"
+            << "  --light-samples n       lights picked at random at every hit, 0 uses all of\n"
+            << "                          them (default all up to " << MAX_LIGHTS_SHADED_ALL << " lights, 1 with more)\n"
+            << "  --checkpoint file       where to save the render state (default image.checkpoint)\n"
+            << "  --checkpoint-interval s seconds between checkpoints, 0 disables them (default 60)\n"
+            << "  --resume                continue the render saved in the checkpoint\n"
+            << "  --bvh-stats             print the acceleration structure statistics\n"
+            << "  --stats                 print what is in the scene, its memory, how long each step\n"
+            << "                          of loading it took, when the first pass was done and\n"
+            << "                          the rays that were traced\n"
+            << "  --strict                treat the warnings about the scene file as errors\n"
+            << "  --crop x0 y0 x1 y1      render only the pixels [x0, x1) x [y0, y1), row 0 on top\n"
+            << "  --crop-object name      render only the pixels the instances of an object cover\n"
+            << "  --interactive           render again what changes when the scene file is saved\n"
+            << "  --headless              don't open a window, only write the images\n"
+            << "  --threads n             render on n threads (default all of them)\n"
+            << "  --compare ref.pfm a.pfm compare an HDR image with a reference one, the exit\n"
+            << "                          status is 1 if a pixel is out of the tolerance\n"
+            << "  --tolerance abs rel     a channel is out if it differs by more than\n"
+            << "                          abs + rel*|reference| (default 1e-4 1e-3)\n"
+            << "  --denoise               filter the image guided by albedo, normals, depth and\n"
+            << "                          the per-pixel noise (needs at least 2 spp)\n"
+            << "  --denoise-iterations n  passes of the denoising filter, 1 to " << MAX_DENOISE_ITERATIONS
+            << " (default 5)\n"
+            << "  --exposure stops        scale radiance by 2^stops (default 0)\n"
+            << "  --tonemap op            clamp, reinhard or aces (default clamp)\n"
+            << "  --srgb                  encode the output with the sRGB curve\n"
+            << "  --hdr-output file.pfm   where to write the HDR image (default image.pfm)\n"
+            << "  --tiled-output file     render in tiles of " << OUTPUT_TILE_SIZE << " pixels into a tiled HDR file,\n"
+            << "                          keeping only the tiles being rendered in memory\n"
+            << "  --from-hdr file         tone map an HDR image (.pfm or tiled) instead of rendering\n";
+}
+
+bool parseArguments(int argc, char *argv[], renderOptions *options)
+{
+  bool result = true;
+
+  options->hdrOutputFileName = "image.pfm";
+  options->imageFileName = "image.ppm";
+  options->tonemap.exposure = 0.0;
+  options->tonemap.op = tonemapClamp;
+  options->tonemap.srgb = false;
+  options->width = WIDTH;
+  options->height = HEIGHT;
+  options->samples = MAX_SAMPLES;
+  options->seed = 0;
+  options->lightSamples = -1;
+  options->checkpointFileName = "image.checkpoint";
+  options->checkpointInterval = 60.0;
+  options->denoiser = defaultDenoiseSettings();
+  options->absoluteTolerance = 1e-4;
+  options->relativeTolerance = 1e-3;
+
+  for (int32 i = 1; (i < argc) && result; i++)
+  {
+    char *arg = argv[i];
+    bool hasValue = (i + 1) < argc;
+
+    if ((strcmp(arg, "--size") == 0) && ((i + 2) < argc))
+    {
+      options->width = atoi(argv[++i]);
+      options->height = atoi(argv[++i]);
+      result = (options->width > 0) && (options->height > 0);
+      if (!result)
+      {
+        std::cout << "--size takes a width and a height over 0.\n";
+      }
+    }
+    else if ((strcmp(arg, "--spp") == 0) && hasValue)
+    {
+      options->samples = atoi(argv[++i]);
+      result = options->samples > 0;
+    }
+    else if ((strcmp(arg, "--seed") == 0) && hasValue)
+    {
+      options->seed = strtoull(argv[++i], 0, 10);
+    }
+    else if ((strcmp(arg, "--light-samples") == 0) && hasValue)
+    {
+      options->lightSamples = atoi(argv[++i]);
+      result = options->lightSamples >= 0;
+    }
+    else if ((strcmp(arg, "--checkpoint") == 0) && hasValue)
+    {
+      options->checkpointFileName = argv[++i];
+    }
+    else if ((strcmp(arg, "--checkpoint-interval") == 0) && hasValue)
+    {
+      options->checkpointInterval = atof(argv[++i]);
+    }
+    else if (strcmp(arg, "--resume") == 0)
+    {
+      options->resume = true;
+    }
+    else if (strcmp(arg, "--bvh-stats") == 0)
+    {
+      options->bvhStats = true;
+    }
+    else if (strcmp(arg, "--stats") == 0)
+    {
+      options->stats = true;
+    }
+    else if (strcmp(arg, "--strict") == 0)
+    {
+      options->strict = true;
+    }
+    else if ((strcmp(arg, "--crop") == 0) && ((i + 4) < argc))
+    {
+      options->crop = true;
+      options->cropRegion.minX = atoi(argv[++i]);
+      options->cropRegion.minY = atoi(argv[++i]);
+      options->cropRegion.maxX = atoi(argv[++i]);
+      options->cropRegion.maxY = atoi(argv[++i]);
+    }
+    else if ((strcmp(arg, "--crop-object") == 0) && hasValue)
+    {
+      options->cropObjectName = argv[++i];
+    }
+    else if (strcmp(arg, "--interactive") == 0)
+    {
+      options->interactive = true;
+    }
+    else if (strcmp(arg, "--headless") == 0)
+    {
+      options->headless = true;
+    }
+    else if ((strcmp(arg, "--threads") == 0) && hasValue)
+    {
+      options->threads = atoi(argv[++i]);
+      result = options->threads > 0;
+    }
+    else if ((strcmp(arg, "--compare") == 0) && ((i + 2) < argc))
+    {
+      options->compareFileNames[0] = argv[++i];
+      options->compareFileNames[1] = argv[++i];
+    }
+    else if ((strcmp(arg, "--tolerance") == 0) && ((i + 2) < argc))
+    {
+      options->absoluteTolerance = atof(argv[++i]);
+      options->relativeTolerance = atof(argv[++i]);
+      result = (options->absoluteTolerance >= 0.0f) && (options->relativeTolerance >= 0.0f);
+    }
+    else if (strcmp(arg, "--denoise") == 0)
+    {
+      options->denoise = true;
+    }
+    else if ((strcmp(arg, "--denoise-iterations") == 0) && hasValue)
+    {
+      options->denoiser.iterations = atoi(argv[++i]);
+      result = (options->denoiser.iterations >= 1) && (options->denoiser.iterations <= MAX_DENOISE_ITERATIONS);
+    }
+    else if ((strcmp(arg, "--exposure") == 0) && hasValue)
+    {
+      options->tonemap.exposure = atof(argv[++i]);
+    }
+    else if ((strcmp(arg, "--tonemap") == 0) && hasValue)
+    {
+      result = parseTonemapOperator(argv[++i], &options->tonemap.op);
+    }
+    else if (strcmp(arg, "--srgb") == 0)
+    {
+      options->tonemap.srgb = true;
+    }
+    else if ((strcmp(arg, "--hdr-output") == 0) && hasValue)
+    {
+      options->hdrOutputFileName = argv[++i];
+    }
+    else if ((strcmp(arg, "--tiled-output") == 0) && hasValue)
+    {
+      options->tiledOutputFileName = argv[++i];
+    }
+    else if ((strcmp(arg, "--from-hdr") == 0) && hasValue)
+    {
+      options->hdrInputFileName = argv[++i];
+    }
+    else if ((arg[0] != '-') && (options->sceneFileName == 0))
+    {
+      options->sceneFileName = arg;
+    }
+    else
+    {
+      std::cout << "Unknown or incomplete option: " << arg << "\n";
+      result = false;
+    }
+  }
+
+  if (result && (options->sceneFileName == 0) && (options->hdrInputFileName == 0) &&
+      (options->compareFileNames[0] == 0))
+  {
+    std::cout << "Missing scene file.\n";
+    result = false;
+  }
+
+  // NOTE(ralntdir): After the loop, --size may come after --crop.
+  if (result && options->crop &&
+      isEmpty(intersect(options->cropRegion, fullRegion(options->width, options->height))))
+  {
+    std::cout << "The crop region is outside of the image.\n";
+    result = false;
+  }
+
+  if (result && options->headless && options->interactive)
+  {
+    std::cout << "--interactive needs a window, it can't be --headless.\n";
+    result = false;
+  }
+
+  // NOTE(ralntdir): The tiles are finished one by one and forgotten, and
+  // nothing else is, there's no whole image to resume, denoise or show.
+  if (result && options->tiledOutputFileName)
+  {
+    if (options->interactive || options->resume || options->denoise)
+    {
+      std::cout << "--tiled-output can't be used with --interactive, --resume or --denoise.\n";
+      result = false;
+    }
+    options->headless = true;
+  }
+
+  // NOTE(ralntdir): A whole image is kept in memory unless it's rendered
+  // in tiles, and then only the number of tiles is limited.
+  if (result && !options->tiledOutputFileName && !validImageSize(options->width, options->height))
+  {
+    std::cout << options->width << "x" << options->height << " is too big to keep in memory, "
+              << "render it with --tiled-output.\n";
+    result = false;
+  }
+  if (result && options->tiledOutputFileName &&
+      ((uint64)tileCount(options->width, OUTPUT_TILE_SIZE)*tileCount(options->height, OUTPUT_TILE_SIZE) > INT32_MAX))
+  {
+    std::cout << options->width << "x" << options->height << " has too many tiles.\n";
+    result = false;
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): Reads the scene without building anything.
+bool readScene(scene *myScene, renderOptions *options, startupTimes *times)
+{
+  bool result = readSceneFile(myScene, options->sceneFileName, options->strict, times);
+  setupCamera(&myScene->view, (real32)options->width/options->height);
+
+  myScene->lightSamples = options->lightSamples;
+  if (myScene->lightSamples == -1)
+  {
+    myScene->lightSamples = (myScene->lights.size() <= MAX_LIGHTS_SHADED_ALL) ? 0 : 1;
+  }
+
+  return(result);
+}
+
+std::string formatBytes(size_t bytes)
+{
+  char buffer[32];
+
+  if (bytes < 1024)
+  {
+    snprintf(buffer, sizeof(buffer), "%d B", (int32)bytes);
+  }
+  else if (bytes < 1024*1024)
+  {
+    snprintf(buffer, sizeof(buffer), "%.1f KB", bytes/1024.0);
+  }
+  else
+  {
+    snprintf(buffer, sizeof(buffer), "%.1f MB", bytes/(1024.0*1024.0));
+  }
+
+  std::string result = buffer;
+
+  return(result);
+}
+
+void countMeshes(std::vector<mesh> &meshes, int32 *counts)
+{
+  for (size_t i = 0; i < meshes.size(); i++)
+  {
+    counts[meshes[i].type]++;
+  }
+}
+
+// NOTE(ralntdir): What the scene has and how much memory it takes, plus
+// what the render itself will need for the image.
+void printSceneStats(scene *myScene, startupTimes *times, renderOptions *options)
+{
+  int32 sceneMeshes[3] = {};
+  int32 objectMeshes[3] = {};
+  int32 instancedMeshes = 0;
+
+  countMeshes(myScene->meshes, sceneMeshes);
+  for (size_t i = 0; i < myScene->objects.size(); i++)
+  {
+    countMeshes(myScene->objects[i].meshes, objectMeshes);
+  }
+  for (size_t i = 0; i < myScene->instances.size(); i++)
+  {
+    instancedMeshes += (int32)myScene->objects[myScene->instances[i].objectIndex].meshes.size();
+  }
+
+  int32 lightCounts[4] = {};
+  for (size_t i = 0; i < myScene->lights.size(); i++)
+  {
+    lightCounts[myScene->lights[i].type]++;
+  }
+
+  size_t numMeshes = myScene->meshes.size();
+  size_t overrides = 0;
+  size_t accelerationMemory = bvhMemory(&myScene->topLevel);
+  for (size_t i = 0; i < myScene->objects.size(); i++)
+  {
+    numMeshes += myScene->objects[i].meshes.size();
+    accelerationMemory += bvhMemory(&myScene->objects[i].tree);
+  }
+  for (size_t i = 0; i < myScene->instances.size(); i++)
+  {
+    overrides += myScene->instances[i].overrideMaterial ? 1 : 0;
+  }
+  lightTree *tree = &myScene->lightHierarchy;
+  accelerationMemory += tree->nodes.size()*sizeof(lightTreeNode) + tree->unbounded.size()*sizeof(int32);
+
+  // NOTE(ralntdir): Materials live inside the meshes and the instances,
+  // they're counted apart to see how much of a mesh they are.
+  size_t materialMemory = (numMeshes + overrides)*sizeof(materialParameters);
+  size_t geometryMemory = numMeshes*(sizeof(mesh) - sizeof(materialParameters));
+  size_t instanceMemory = myScene->instances.size()*(sizeof(instance) - sizeof(materialParameters));
+  size_t lightMemory = myScene->lights.size()*sizeof(light);
+
+  size_t pixelMemory = ACCUMULATION_CHANNELS*sizeof(real32) + sizeof(uint32) + sizeof(randomSeries);
+  size_t pixels = (size_t)options->width*options->height;
+  size_t renderMemory = pixels*pixelMemory + pixels*3*sizeof(real32)*5 + pixels*3;
+
+  // NOTE(ralntdir): A tile and its colors on every thread, and the index.
+  if (options->tiledOutputFileName)
+  {
+    size_t tilePixels = OUTPUT_TILE_SIZE*OUTPUT_TILE_SIZE;
+    size_t tiles = (size_t)tileCount(options->width, OUTPUT_TILE_SIZE)*tileCount(options->height, OUTPUT_TILE_SIZE);
+    renderMemory = omp_get_max_threads()*tilePixels*(pixelMemory + 3*sizeof(real32)) + tiles*sizeof(uint64);
+  }
+
+  std::cout << "Scene statistics\n"
+            << "  meshes:      " << sceneMeshes[sphere] << " spheres, " << sceneMeshes[plane] << " planes, "
+            << sceneMeshes[triangle] << " triangles\n"
+            << "  objects:     " << myScene->objects.size() << " (" << objectMeshes[sphere] << " spheres, "
+            << objectMeshes[plane] << " planes, " << objectMeshes[triangle] << " triangles)\n"
+            << "  instances:   " << myScene->instances.size() << " (" << instancedMeshes << " meshes placed)\n"
+            << "  lights:      " << lightCounts[point] << " point, " << lightCounts[directional] << " directional, "
+            << lightCounts[spherical] << " sphere, " << lightCounts[quad] << " quad\n";
+
+  if (!myScene->topLevel.nodes.empty())
+  {
+    aabb bounds = myScene->topLevel.nodes[0].bounds;
+    std::cout << "  bounds:      (" << bounds.min.x << ", " << bounds.min.y << ", " << bounds.min.z << ") - ("
+              << bounds.max.x << ", " << bounds.max.y << ", " << bounds.max.z << ")";
+  }
+  else
+  {
+    std::cout << "  bounds:      empty";
+  }
+  if (!myScene->topLevel.unbounded.empty())
+  {
+    std::cout << " + " << myScene->topLevel.unbounded.size() << " unbounded";
+  }
+  std::cout << "\n";
+
+  std::cout << "  memory:      geometry " << formatBytes(geometryMemory)
+            << ", materials " << formatBytes(materialMemory)
+            << ", instances " << formatBytes(instanceMemory)
+            << ", lights " << formatBytes(lightMemory)
+            << ", acceleration " << formatBytes(accelerationMemory) << "\n"
+            << "               render buffers " << formatBytes(renderMemory)
+            << " for " << options->width << "x" << options->height
+            << (options->tiledOutputFileName ? " in tiles" : "") << "\n"
+            << "  time:        read " << times->readMilliseconds << " ms, parse "
+            << times->parseMilliseconds << " ms (" << times->chunks << " chunks), bounds "
+            << times->boundsMilliseconds << " ms, trees " << times->bvhMilliseconds << " ms, light tree "
+            << times->lightTreeMilliseconds << " ms, on " << omp_get_max_threads() << " threads\n";
+}
+
+bool loadScene(scene *myScene, renderOptions *options, bool printStats, startupTimes *times)
+{
+  bool result = readScene(myScene, options, times);
+
+  if (result)
+  {
+    buildAccelerationStructures(myScene, printStats, times);
+
+    if (options->stats)
+    {
+      printSceneStats(myScene, times, options);
+    }
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): Set by SIGINT/SIGTERM, the render stops after the
+// current pass and leaves a checkpoint behind.
+volatile sig_atomic_t globalStopRequested = 0;
+
+void requestStop(int)
+{
+  globalStopRequested = 1;
+}
+
+// NOTE(ralntdir): Where pixel j of row i (from the bottom) is sampled on
+// the image plane and on the lens, taken from its random series. The lens
+// only draws numbers for a thin lens camera.
+inline void addCameraSample(camera *view, cameraBatch *batch, int32 index, int32 i, int32 j,
+                            int32 width, int32 height, randomSeries *series)
+{
+  batch->u[index] = real32(j + randomUnilateral(series))/real32(width);
+  batch->v[index] = real32(i + randomUnilateral(series))/real32(height);
+
+  if (view->thinLens)
+  {
+    real32 u1 = randomUnilateral(series);
+    real32 u2 = randomUnilateral(series);
+    sampleDisk(u1, u2, &batch->lensX[index], &batch->lensY[index]);
+  }
+}
+
+inline ray batchRay(cameraBatch *batch, int32 index)
+{
+  ray result = {};
+
+  result.origin.x = batch->originX[index];
+  result.origin.y = batch->originY[index];
+  result.origin.z = batch->originZ[index];
+  result.direction.x = batch->directionX[index];
+  result.direction.y = batch->directionY[index];
+  result.direction.z = batch->directionZ[index];
+
+  return(result);
+}
+
+// NOTE(ralntdir): From the counters of a thread into the totals.
+void addRayCounters(rayCounters *total, rayCounters *counters)
+{
+  #pragma omp atomic
+  total->camera += counters->camera;
+  #pragma omp atomic
+  total->shadow += counters->shadow;
+  #pragma omp atomic
+  total->reflection += counters->reflection;
+  #pragma omp atomic
+  total->refraction += counters->refraction;
+  #pragma omp atomic
+  total->reflectionsCut += counters->reflectionsCut;
+  #pragma omp atomic
+  total->reflectionsLimited += counters->reflectionsLimited;
+}
+
+void printRayCounters(rayCounters *rays)
+{
+  uint64 traced = rays->camera + rays->shadow + rays->reflection + rays->refraction;
+
+  std::cout << "Rays: " << traced << " traced (" << rays->camera << " camera, " << rays->shadow << " shadow, "
+            << rays->reflection << " reflection, " << rays->refraction << " refraction), reflections not traced: " << rays->reflectionsCut
+            << " too dim to see, " << rays->reflectionsLimited << " past the bounces of their material\n";
+}
+
+// NOTE(ralntdir): Adds up to passSamples samples to every pixel of the
+// region that doesn't have targetSamples yet, the pixels outside it are
+// left as they are. Returns true if some pixel still needs more. The
+// region is in pixels of the image, and has to be inside the buffer if
+// the buffer is a tile.
+bool renderPass(scene *myScene, accumulationBuffer *accum, imageRegion region,
+                uint32 targetSamples, uint32 passSamples)
+{
+  bool result = false;
+
+  camera *view = &myScene->view;
+
+  int32 width = accum->imageWidth;
+  int32 height = accum->imageHeight;
+  int32 depth = 1;
+  vec3 throughput = { 1.0f, 1.0f, 1.0f };
+
+  // NOTE(ralntdir): From top to bottom. Rows take very different times
+  // (sky vs. reflective spheres), so they are handed out dynamically.
+  #pragma omp parallel for schedule(dynamic) reduction(||:result)
+  for (int32 y = region.minY; y < region.maxY; y++)
+  {
+    // NOTE(ralntdir): i counts rows from the bottom
+    int32 i = height-1-y;
+    rayCounters rays = {};
+
+    // NOTE(ralntdir): The camera rays of a row are made CAMERA_BATCH
+    // pixels at a time. Every round takes one sample in each pixel of the
+    // batch that still needs one, so a pixel draws its random numbers in
+    // the same order as if it was rendered on its own.
+    for (int32 batchStart = region.minX; batchStart < region.maxX; batchStart += CAMERA_BATCH)
+    {
+      int32 batchSize = region.maxX - batchStart;
+      batchSize = (batchSize < CAMERA_BATCH) ? batchSize : CAMERA_BATCH;
+
+      randomSeries series[CAMERA_BATCH];
+      uint32 samples[CAMERA_BATCH];
+      uint32 passEnd[CAMERA_BATCH];
+
+      for (int32 k = 0; k < batchSize; k++)
+      {
+        size_t index = accumulationIndex(accum, batchStart + k, y);
+
+        series[k] = accum->series[index];
+        samples[k] = accum->samples[index];
+        passEnd[k] = samples[k] + passSamples;
+        if (passEnd[k] > targetSamples)
+        {
+          passEnd[k] = targetSamples;
+        }
+      }
+
+      cameraBatch batch;
+      int32 pixels[CAMERA_BATCH];
+
+      for (uint32 round = 0; round < passSamples; round++)
+      {
+        int32 count = 0;
+        for (int32 k = 0; k < batchSize; k++)
+        {
+          if (samples[k] < passEnd[k])
+          {
+            addCameraSample(view, &batch, count, i, batchStart + k, width, height, &series[k]);
+            pixels[count++] = k;
+          }
+        }
+
+        if (count == 0)
+        {
+          break;
+        }
+
+        generateCameraRays(view, &batch, count);
+
+        for (int32 n = 0; n < count; n++)
+        {
+          int32 k = pixels[n];
+          int32 j = batchStart + k;
+          size_t index = accumulationIndex(accum, j, y);
+
+          vec3 backgroundColor = { 0.0, ((real32)i/height), ((real32)j/width) };
+
+          // NOTE(ralntdir): Samples are accumulated unclamped, the
+          // dynamic range is handled later by the tone mapping.
+          firstHitInfo firstHit = {};
+          vec3 sampleColor = color(batchRay(&batch, n), myScene, backgroundColor, depth, throughput,
+                                   &firstHit, &series[k], &rays);
+          rays.camera++;
+
+          real32 *col = accum->color + 3*index;
+          real32 *albedo = accum->albedo + 3*index;
+          real32 *normal = accum->normal + 3*index;
+
+          for (int32 c = 0; c < 3; c++)
+          {
+            col[c] += sampleColor.e[c];
+            albedo[c] += firstHit.albedo.e[c];
+            normal[c] += firstHit.normal.e[c];
+          }
+          accum->depth[index] += firstHit.depth;
+
+          real32 luminance = 0.2126*sampleColor.r + 0.7152*sampleColor.g + 0.0722*sampleColor.b;
+          accum->luminance[index] += luminance;
+          accum->luminanceSquared[index] += luminance*luminance;
+
+          samples[k]++;
+        }
+      }
+
+      for (int32 k = 0; k < batchSize; k++)
+      {
+        size_t index = accumulationIndex(accum, batchStart + k, y);
+
+        accum->series[index] = series[k];
+        accum->samples[index] = samples[k];
+
+        if (samples[k] < targetSamples)
+        {
+          result = true;
+        }
+      }
+    }
+
+    addRayCounters(&myScene->rays, &rays);
+  }
+
+  return(result);
+}
+
+// NOTE(ralntdir): 1 sample through the middle of every scale x scale
+// block of the image, into a preview scale times smaller. Nothing is
+// accumulated, the random series only depend on the frame.
+void renderPreview(scene *myScene, framebuffer *preview, int32 width, int32 height,
+                   int32 scale, uint32 frame)
+{
+  camera *view = &myScene->view;
+
+  int32 depth = 1;
+  vec3 throughput = { 1.0f, 1.0f, 1.0f };
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int32 y = 0; y < preview->height; y++)
+  {
+    int32 i = height-1-(y*scale + scale/2);
+    i = (i >= 0) ? i : 0;
+    rayCounters rays = {};
+
+    for (int32 batchStart = 0; batchStart < preview->width; batchStart += CAMERA_BATCH)
+    {
+      int32 batchSize = preview->width - batchStart;
+      batchSize = (batchSize < CAMERA_BATCH) ? batchSize : CAMERA_BATCH;
+
+      cameraBatch batch;
+      randomSeries series[CAMERA_BATCH];
+
+      for (int32 k = 0; k < batchSize; k++)
+      {
+        int32 x = batchStart + k;
+        int32 j = x*scale + scale/2;
+        j = (j < width) ? j : width - 1;
+
+        series[k] = seedSeries(frame*0x9E3779B97F4A7C15ull + y*preview->width + x);
+
+        batch.u[k] = (j + 0.5f)/real32(width);
+        batch.v[k] = (i + 0.5f)/real32(height);
+        if (view->thinLens)
+        {
+          real32 u1 = randomUnilateral(&series[k]);
+          real32 u2 = randomUnilateral(&series[k]);
+          sampleDisk(u1, u2, &batch.lensX[k], &batch.lensY[k]);
+        }
+      }
+
+      generateCameraRays(view, &batch, batchSize);
+
+      for (int32 k = 0; k < batchSize; k++)
+      {
+        int32 x = batchStart + k;
+        int32 j = x*scale + scale/2;
+        j = (j < width) ? j : width - 1;
+
+        vec3 backgroundColor = { 0.0, ((real32)i/height), ((real32)j/width) };
+
+        firstHitInfo firstHit = {};
+        vec3 sampleColor = color(batchRay(&batch, k), myScene, backgroundColor, depth, throughput,
+                                 &firstHit, &series[k], &rays);
+        rays.camera++;
+        setPixel(preview, x, y, sampleColor);
+      }
+    }
+
+    addRayCounters(&myScene->rays, &rays);
+  }
+}
+
+real64 secondsSince(std::chrono::steady_clock::time_point start)
+{
+  std::chrono::duration<real64> elapsed = std::chrono::steady_clock::now() - start;
+  real64 result = elapsed.count();
+
+  return(result);
+}
+
+// NOTE(ralntdir): Renders in passes of SAMPLES_PER_PASS samples until
+// every pixel has targetSamples, and saves the state between passes
+// every checkpointInterval seconds (0 disables it). If programStart
+// isn't 0, says how long after it the first pass was done.
+void renderScene(scene *myScene, accumulationBuffer *accum, imageRegion region, int32 targetSamples,
+                 const char *checkpointFileName, real64 checkpointInterval, uint64 sceneHash,
+                 std::chrono::steady_clock::time_point *programStart)
+{
+  checkpointWriter writer = {};
+  writer.filename = checkpointFileName;
+  writer.sceneHash = sceneHash;
+  writer.lightSamples = myScene->lightSamples;
+  bool checkpointsWritten = false;
+
+  globalStopRequested = 0;
+  signal(SIGINT, requestStop);
+  signal(SIGTERM, requestStop);
+
+  std::chrono::steady_clock::time_point lastCheckpoint = std::chrono::steady_clock::now();
+
+  bool remaining = true;
+  while (remaining && !globalStopRequested)
+  {
+    remaining = renderPass(myScene, accum, region, targetSamples, SAMPLES_PER_PASS);
+
+    if (programStart)
+    {
+      std::cout << "First pass done " << 1000.0*secondsSince(*programStart) << " ms after the start\n";
+      programStart = 0;
+    }
+
+    if (remaining && (checkpointInterval > 0.0) &&
+        (secondsSince(lastCheckpoint) >= checkpointInterval))
+    {
+      if (startCheckpoint(&writer, accum))
+      {
+        checkpointsWritten = true;
+        lastCheckpoint = std::chrono::steady_clock::now();
+      }
+    }
+  }
+
+  // NOTE(ralntdir): The last state is saved if the render was stopped,
+  // or if there was a checkpoint already, so it isn't left behind with
+  // fewer samples than the image.
+  if (globalStopRequested || checkpointsWritten)
+  {
+    while (writer.busy)
+    {
+      std::this_thread::yield();
+    }
+    startCheckpoint(&writer, accum);
+  }
+  finishCheckpoints(&writer);
+
+  if (writer.failed)
+  {
+    std::cout << "There was a problem writing the checkpoint " << checkpointFileName << "\n";
+  }
+  else if (globalStopRequested)
+  {
+    std::cout << "Render stopped, continue it with --resume (" << checkpointFileName << ")\n";
+  }
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+}
+
+// NOTE(ralntdir): Every thread takes a tile, renders all its samples and
+// writes it, so memory only holds a tile per thread whatever the size of
+// the image. The pixels are the same ones a render of the whole image
+// gives. Tiles outside of the region aren't written, and if the render
+// is stopped neither are the ones that weren't started.
+bool renderTiled(scene *myScene, imageRegion region, int32 width, int32 height, int32 targetSamples,
+                 uint64 seed, const char *fileName)
+{
+  tiledImageWriter writer;
+  bool result = startTiledImage(&writer, fileName, width, height, OUTPUT_TILE_SIZE);
+
+  if (!result)
+  {
+    std::cout << "Can't write " << fileName << "\n";
+    return(result);
+  }
+
+  globalStopRequested = 0;
+  signal(SIGINT, requestStop);
+  signal(SIGTERM, requestStop);
+
+  int32 count = writer.tilesX*writer.tilesY;
+
+  // NOTE(ralntdir): Tiles take very different times, and renderPass()
+  // inside runs on the thread of its tile.
+  #pragma omp parallel for schedule(dynamic)
+  for (int32 i = 0; i < count; i++)
+  {
+    imageRegion tile = tileRegion(width, height, OUTPUT_TILE_SIZE, i);
+    imageRegion rendered = intersect(tile, region);
+
+    if (!isEmpty(rendered) && !globalStopRequested)
+    {
+      accumulationBuffer accum = allocateAccumulationTile(tile, width, height, seed);
+      framebuffer fb = allocateFramebuffer(accum.width, accum.height);
+
+      renderPass(myScene, &accum, rendered, targetSamples, targetSamples);
+      resolveAccumulationColor(&accum, &fb);
+      writeTile(&writer, i, &fb);
+
+      freeFramebuffer(&fb);
+      freeAccumulationBuffer(&accum);
+    }
+  }
+
+  result = finishTiledImage(&writer);
+
+  if (!result)
+  {
+    std::cout << "There was a problem writing " << fileName << "\n";
+  }
+  else if (globalStopRequested)
+  {
+    std::cout << "Render stopped, " << fileName << " only has the tiles that were finished\n";
+  }
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+
+  return(result);
+}
+
+// NOTE(ralntdir): Watches the directory of the file and not the file
+// itself, most editors save by writing a new file and renaming it over
+// the old one, and a watch on the old file never sees that.
+struct fileWatcher
+{
+  int fd;
+  int watch;
+  std::string name;
+};
+
+bool startWatching(fileWatcher *watcher, const char *filename)
+{
+  std::string path = filename;
+  std::string directory = ".";
+  watcher->name = path;
+
+  size_t slash = path.rfind('/');
+  if (slash != std::string::npos)
+  {
+    directory = (slash == 0) ? "/" : path.substr(0, slash);
+    watcher->name = path.substr(slash + 1);
+  }
+
+  watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  watcher->watch = -1;
+  if (watcher->fd != -1)
+  {
+    watcher->watch = inotify_add_watch(watcher->fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+  }
+
+  bool result = (watcher->watch != -1);
+
+  return(result);
+}
+
+// NOTE(ralntdir): Never blocks. Takes every pending event, so a save
+// that comes as several events is only reported once.
+bool fileChanged(fileWatcher *watcher)
+{
+  bool result = false;
+
+  // NOTE(ralntdir): Aligned like the struct, the events are read in place.
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  for (;;)
+  {
+    ssize_t size = read(watcher->fd, buffer, sizeof(buffer));
+    if (size <= 0)
+    {
+      break;
+    }
+
+    for (char *p = buffer; p < buffer + size; )
+    {
+      struct inotify_event *event = (struct inotify_event *)p;
+      if ((event->len > 0) && (watcher->name == event->name))
+      {
+        result = true;
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+
+  return(result);
+}
+
+void stopWatching(fileWatcher *watcher)
+{
+  if (watcher->fd != -1)
+  {
+    close(watcher->fd);
+  }
+  watcher->fd = -1;
+  watcher->watch = -1;
+}
+
+// NOTE(ralntdir): Where the viewer has moved the camera of the scene
+// file: an offset, a turn around the up of the image plane (yaw) and one
+// around its right (pitch). The camera of the file is kept apart, so
+// saving the file doesn't throw the navigation away.
+struct cameraControl
+{
+  camera fileView;
+
+  vec3 offset;
+  real32 yaw;
+  real32 pitch;
+};
+
+void setFileCamera(cameraControl *control, scene *myScene)
+{
+  control->fileView = myScene->view;
+}
+
+inline vec3 cameraUp(cameraControl *control)
+{
+  vec3 result = normalize(control->fileView.vertical);
+
+  return(result);
+}
+
+inline vec3 cameraRight(cameraControl *control)
+{
+  vec3 result = normalize(control->fileView.horizontal);
+
+  return(result);
+}
+
+mat4 cameraRotation(cameraControl *control)
+{
+  mat4 result = rotation(cameraUp(control), control->yaw)*rotation(cameraRight(control), control->pitch);
+
+  return(result);
+}
+
+void applyCameraControl(cameraControl *control, scene *myScene)
+{
+  mat4 turn = cameraRotation(control);
+
+  camera *fileView = &control->fileView;
+  camera *view = &myScene->view;
+
+  *view = *fileView;
+  view->position = fileView->position + control->offset;
+  view->lowerLeft = transformVector(turn, fileView->lowerLeft);
+  view->horizontal = transformVector(turn, fileView->horizontal);
+  view->vertical = transformVector(turn, fileView->vertical);
+  view->lensU = transformVector(turn, fileView->lensU);
+  view->lensV = transformVector(turn, fileView->lensV);
+}
+
+// NOTE(ralntdir): WASD moves in the direction the camera looks, Q and E
+// down and up, shift goes faster, dragging with the left button turns.
+// Returns true if the camera moved.
+bool moveCamera(cameraControl *control, int32 mouseX, int32 mouseY, real32 seconds)
+{
+  const Uint8 *keys = SDL_GetKeyboardState(0);
+
+  mat4 turn = cameraRotation(control);
+  camera *fileView = &control->fileView;
+  vec3 center = fileView->lowerLeft + 0.5f*fileView->horizontal + 0.5f*fileView->vertical;
+  vec3 forward = normalize(transformVector(turn, center));
+  vec3 right = transformVector(turn, cameraRight(control));
+  vec3 up = cameraUp(control);
+
+  real32 ahead = (real32)keys[SDL_SCANCODE_W] - (real32)keys[SDL_SCANCODE_S];
+  real32 aside = (real32)keys[SDL_SCANCODE_D] - (real32)keys[SDL_SCANCODE_A];
+  real32 above = (real32)keys[SDL_SCANCODE_E] - (real32)keys[SDL_SCANCODE_Q];
+  vec3 direction = ahead*forward + aside*right + above*up;
+
+  bool result = (length(direction) > 0.0f) || mouseX || mouseY;
+
+  if (length(direction) > 0.0f)
+  {
+    real32 speed = keys[SDL_SCANCODE_LSHIFT] ? CAMERA_FAST_SPEED : CAMERA_SPEED;
+    control->offset += speed*seconds*normalize(direction);
+  }
+
+  control->yaw -= CAMERA_DEGREES_PER_PIXEL*mouseX;
+  control->pitch -= CAMERA_DEGREES_PER_PIXEL*mouseY;
+  control->pitch = min(max(control->pitch, -89.0f), 89.0f);
+
+  return(result);
+}
+
+// NOTE(ralntdir): Nearest neighbour, every pixel of small covers a
+// scale x scale block of out.
+void upscale(uint8 *small, int32 smallWidth, int32 scale, uint8 *out, int32 width, int32 height)
+{
+  #pragma omp parallel for
+  for (int32 y = 0; y < height; y++)
+  {
+    uint8 *row = small + 3*(y/scale)*smallWidth;
+    for (int32 x = 0; x < width; x++)
+    {
+      uint8 *pixel = row + 3*(x/scale);
+      size_t i = 3*((size_t)y*width + x);
+      out[i + 0] = pixel[0];
+      out[i + 1] = pixel[1];
+      out[i + 2] = pixel[2];
+    }
+  }
+}
+
+// NOTE(ralntdir): One sample per pixel per frame, shown as it goes. When
+// the scene file is saved it's read again, the changes are applied to
+// the scene that is loaded, and only the tiles where the two versions
+// differ start over from 0 samples. While the camera moves only a low
+// resolution preview is rendered, and the image starts over when it
+// stops. Runs until the window is closed, the pixels keep what they have
+// for the output files.
+void renderInteractive(scene *myScene, accumulationBuffer *accum, imageRegion region,
+                       renderOptions *options, SDL_Window *window, SDL_Renderer *renderer)
+{
+  int32 width = accum->width;
+  int32 height = accum->height;
+
+  framebuffer fb = allocateFramebuffer(width, height);
+  auxBuffers aux = allocateAuxBuffers(width, height);
+  uint8 *ldrPixels = new uint8[3*pixelCount(width, height)];
+
+  SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB24,
+                                           SDL_TEXTUREACCESS_STREAMING, width, height);
+  if (texture == 0)
+  {
+    std::cout << "Error in SDL_CreateTexture(): " << SDL_GetError() << "\n";
+  }
+
+  fileWatcher watcher = {};
+  if (!startWatching(&watcher, options->sceneFileName))
+  {
+    std::cout << "Can't watch " << options->sceneFileName << " for changes: " << strerror(errno) << "\n";
+  }
+
+  cameraControl control = {};
+  setFileCamera(&control, myScene);
+
+  int32 previewScale = 4;
+  framebuffer preview = allocateFramebuffer(width, height);
+  uint8 *previewPixels = new uint8[3*pixelCount(width, height)];
+
+  bool running = true;
+  bool remaining = true;
+  bool wasMoving = false;
+  uint32 frame = 0;
+
+  std::chrono::steady_clock::time_point lastFrame = std::chrono::steady_clock::now();
+
+  while (running)
+  {
+    // NOTE(ralntdir): A long frame (a full resolution pass) doesn't make
+    // the camera jump when it starts moving.
+    real32 frameSeconds = min((real32)secondsSince(lastFrame), 0.1f);
+    lastFrame = std::chrono::steady_clock::now();
+    frame++;
+
+    int32 mouseX = 0;
+    int32 mouseY = 0;
+
+    SDL_Event event;
+    while (SDL_PollEvent(&event))
+    {
+      if (event.type == SDL_QUIT)
+      {
+        running = false;
+      }
+      else if ((event.type == SDL_KEYDOWN) && (event.key.keysym.sym == SDLK_ESCAPE))
+      {
+        running = false;
+      }
+      else if ((event.type == SDL_MOUSEMOTION) && (event.motion.state & SDL_BUTTON_LMASK))
+      {
+        mouseX += event.motion.xrel;
+        mouseY += event.motion.yrel;
+      }
+    }
+
+    bool moving = moveCamera(&control, mouseX, mouseY, frameSeconds);
+    if (moving)
+    {
+      applyCameraControl(&control, myScene);
+    }
+
+    if ((watcher.fd != -1) && fileChanged(&watcher))
+    {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+      // NOTE(ralntdir): A scene that doesn't read keeps the one on screen,
+      // the frame is still rendered and presented.
+      scene newScene = {};
+      if (!readScene(&newScene, options, 0))
+      {
+        std::cout << "Keeping the scene that was loaded, fix " << options->sceneFileName << " and save it again\n";
+      }
+      else
+      {
+        real64 readMilliseconds = 1000.0*secondsSince(start);
+
+        setFileCamera(&control, &newScene);
+        applyCameraControl(&control, &newScene);
+
+        std::vector<imageRegion> changed;
+        if (findChangedRegions(myScene, &newScene, width, height, &changed))
+        {
+          changed.clear();
+          changed.push_back(fullRegion(width, height));
+        }
+        sceneUpdate update = updateScene(myScene, &newScene);
+
+        int32 tiles = 0;
+        for (size_t i = 0; i < changed.size(); i++)
+        {
+          imageRegion dirty = snapToTiles(intersect(changed[i], region), width, height);
+          if (!isEmpty(dirty))
+          {
+            clearAccumulationRegion(accum, dirty);
+            tiles += ((dirty.maxX - dirty.minX + TILE_SIZE - 1)/TILE_SIZE)*
+                     ((dirty.maxY - dirty.minY + TILE_SIZE - 1)/TILE_SIZE);
+            remaining = true;
+          }
+        }
+
+        std::cout << "Reloaded " << options->sceneFileName << " in " << 1000.0*secondsSince(start)
+                  << " ms (read " << readMilliseconds << " ms): ";
+        if (update.rebuilt)
+        {
+          std::cout << "built again";
+        }
+        else
+        {
+          std::cout << update.materials << " materials, " << update.geometry << " moved, "
+                    << update.lights << " lights";
+        }
+        std::cout << ", " << tiles << " tiles to render again\n";
+      }
+    }
+
+    if (moving)
+    {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+      preview.width = (width + previewScale - 1)/previewScale;
+      preview.height = (height + previewScale - 1)/previewScale;
+      renderPreview(myScene, &preview, width, height, previewScale, frame);
+      tonemap(&preview, options->tonemap, previewPixels);
+      upscale(previewPixels, preview.width, previewScale, ldrPixels, width, height);
+      SDL_UpdateTexture(texture, 0, ldrPixels, 3*width);
+
+      // NOTE(ralntdir): Fewer pixels if the frame took too long, more if
+      // the time grows with the number of pixels and it would still fit.
+      real64 milliseconds = 1000.0*secondsSince(start);
+      real64 finer = (real64)previewScale/(previewScale - 1);
+      if ((milliseconds > PREVIEW_FRAME_MILLISECONDS) && (previewScale < PREVIEW_MAX_SCALE))
+      {
+        previewScale++;
+      }
+      else if ((previewScale > 1) && (milliseconds*finer*finer < 0.8*PREVIEW_FRAME_MILLISECONDS))
+      {
+        previewScale--;
+      }
+
+      char title[128];
+      snprintf(title, sizeof(title), "Devember RT - preview 1/%d, %.0f fps",
+               previewScale, 1.0/max(frameSeconds, 0.001f));
+      SDL_SetWindowTitle(window, title);
+    }
+    else
+    {
+      if (wasMoving)
+      {
+        clearAccumulationRegion(accum, region);
+        remaining = true;
+      }
+
+      if (remaining)
+      {
+        remaining = renderPass(myScene, accum, region, options->samples, 1);
+
+        resolveAccumulationBuffer(accum, &fb, &aux);
+        tonemap(&fb, options->tonemap, ldrPixels);
+        SDL_UpdateTexture(texture, 0, ldrPixels, 3*width);
+
+        char title[128];
+        snprintf(title, sizeof(title), "Devember RT - %u/%d spp",
+                 accum->samples[accumulationIndex(accum, region.minX, region.minY)], options->samples);
+        SDL_SetWindowTitle(window, title);
+      }
+      else
+      {
+        SDL_Delay(16);
+      }
+    }
+    wasMoving = moving;
+
+    SDL_RenderCopy(renderer, texture, 0, 0);
+    SDL_RenderPresent(renderer);
+  }
+
+  stopWatching(&watcher);
+  SDL_DestroyTexture(texture);
+  delete[] previewPixels;
+  freeFramebuffer(&preview);
+  delete[] ldrPixels;
+  freeAuxBuffers(&aux);
+  freeFramebuffer(&fb);
+}
+
+// NOTE(ralntdir): For --compare. Returns the exit status, 0 if the image
+// is within the tolerance of the reference.
+int32 compareHDRFiles(renderOptions *options)
+{
+  int32 result = 1;
+  const char *referenceFileName = options->compareFileNames[0];
+  const char *imageFileName = options->compareFileNames[1];
+
+  framebuffer reference = {};
+  framebuffer image = {};
+
+  if (!readHDRFile(&reference, referenceFileName))
+  {
+    std::cout << "There was a problem reading the HDR file " << referenceFileName << "\n";
+  }
+  else if (!readHDRFile(&image, imageFileName))
+  {
+    std::cout << "There was a problem reading the HDR file " << imageFileName << "\n";
+  }
+  else if ((reference.width != image.width) || (reference.height != image.height))
+  {
+    std::cout << imageFileName << " is " << image.width << "x" << image.height << ", the reference is "
+              << reference.width << "x" << reference.height << "\n";
+  }
+  else
+  {
+    imageDifference difference = compareImages(&reference, &image, options->absoluteTolerance,
+                                               options->relativeTolerance);
+
+    std::cout << imageFileName << ": " << difference.pixels << " pixels out of the tolerance, max error "
+              << difference.maxError << " at (" << difference.maxX << ", " << difference.maxY
+              << "), RMSE " << difference.rmse << "\n";
+
+    result = (difference.pixels == 0) ? 0 : 1;
+  }
+
+  freeFramebuffer(&reference);
+  freeFramebuffer(&image);
+
+  return(result);
+}
+
+int main(int argc, char* argv[])
+{
+  std::chrono::steady_clock::time_point programStart = std::chrono::steady_clock::now();
+
+  SDL_Window *window = 0;
+  SDL_Renderer *renderer = 0;
+  SDL_Surface *surface;
+  SDL_Texture *texture;
+
+  renderOptions options = {};
+  if (!parseArguments(argc, argv, &options))
+  {
+    printUsage();
+    return(1);
+  }
+
+  if (options.compareFileNames[0])
+  {
+    return(compareHDRFiles(&options));
+  }
+
+  if (options.threads > 0)
+  {
+    omp_set_num_threads(options.threads);
+  }
+
+  framebuffer fb = {};
+  auxBuffers aux = {};
+
+  if (options.hdrInputFileName)
+  {
+    if (!readHDRFile(&fb, options.hdrInputFileName))
+    {
+      std::cout << "There was a problem reading the HDR file " << options.hdrInputFileName << "\n";
+      return(1);
+    }
+
+    if (options.denoise && !readAuxBuffers(&aux, options.hdrInputFileName))
+    {
+      std::cout << "There are no albedo/normal/depth/variance files next to " << options.hdrInputFileName
+                << ", they are written when rendering with --denoise\n";
+      return(1);
+    }
+
+    if (options.denoise && !auxBuffersMatch(&aux, fb.width, fb.height))
+    {
+      std::cout << "The albedo/normal/depth/variance files next to " << options.hdrInputFileName
+                << " are not " << fb.width << "x" << fb.height << " like the image, render it again with --denoise\n";
+      return(1);
+    }
+  }
+
+  if (!options.headless)
+  {
+    // Init SDL
+    if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
+    {
+      std::cout << "Error in SDL_Init(): " << SDL_GetError() << "\n";
+    }
+
+    // Init SDL_Image
+    if (IMG_Init(0) < 0)
+    {
+      std::cout << "Error in IMG_Init(): " << IMG_GetError() << "\n";
+    }
+
+    int32 windowWidth = options.hdrInputFileName ? fb.width : options.width;
+    int32 windowHeight = options.hdrInputFileName ? fb.height : options.height;
+
+    // Create a Window
+    // NOTE(ralntdir): SDL_WINDOW_SHOWN is ignored by SDL_CreateWindow().
+    // The SDL_Window is implicitly shown if SDL_WINDOW_HIDDEN is not set.
+    window = SDL_CreateWindow("Devember RT", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                              windowWidth, windowHeight, SDL_WINDOW_SHOWN);
+
+    if (window == 0)
+    {
+      std::cout << "Error in SDL_CreateWindow(): " << SDL_GetError() << "\n";
+    }
+
+    // Create a Renderer
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+
+    if (renderer == 0)
+    {
+      std::cout << "Error in SDL_CreateRenderer(): " << SDL_GetError() << "\n";
+    }
+  }
+
+  if (!options.hdrInputFileName)
+  {
+    scene myScene = {};
+    // Read scene file
+    startupTimes times = {};
+    if (!loadScene(&myScene, &options, options.bvhStats, &times))
+    {
+      return(1);
+    }
+
+    imageRegion region = fullRegion(options.width, options.height);
+    if (options.crop)
+    {
+      region = intersect(options.cropRegion, region);
+    }
+    if (options.cropObjectName)
+    {
+      int32 objectIndex = findObject(&myScene, options.cropObjectName);
+      if (objectIndex == -1)
+      {
+        std::cout << "There is no object called " << options.cropObjectName << "\n";
+        return(1);
+      }
+      region = intersect(objectScreenBounds(&myScene, objectIndex, options.width, options.height), region);
+      std::cout << "Rendering [" << region.minX << ", " << region.maxX << ") x ["
+                << region.minY << ", " << region.maxY << ")\n";
+    }
+
+    if (options.tiledOutputFileName)
+    {
+      if (!renderTiled(&myScene, region, options.width, options.height, options.samples, options.seed,
+                       options.tiledOutputFileName))
+      {
+        return(1);
+      }
+      if (options.stats)
+      {
+        printRayCounters(&myScene.rays);
+      }
+
+      return(0);
+    }
+
+    fb = allocateFramebuffer(options.width, options.height);
+    aux = allocateAuxBuffers(options.width, options.height);
+
+    uint64 sceneHash = hashFile(options.sceneFileName);
+    accumulationBuffer accum = allocateAccumulationBuffer(options.width, options.height, options.seed);
+
+    if (options.resume && !readCheckpoint(&accum, sceneHash, myScene.lightSamples, options.checkpointFileName))
+    {
+      std::cout << "Can't resume from " << options.checkpointFileName
+                << ", it's missing or was made for another scene, size, seed or --light-samples\n";
+      return(1);
+    }
+
+    if (options.interactive)
+    {
+      renderInteractive(&myScene, &accum, region, &options, window, renderer);
+    }
+    else
+    {
+      renderScene(&myScene, &accum, region, options.samples,
+                  options.checkpointFileName, options.checkpointInterval, sceneHash,
+                  options.stats ? &programStart : 0);
+    }
+
+    if (options.stats)
+    {
+      printRayCounters(&myScene.rays);
+    }
+
+    resolveAccumulationBuffer(&accum, &fb, &aux);
+    freeAccumulationBuffer(&accum);
+
+    // NOTE(ralntdir): Keep the raw radiance around so the image can
+    // be tone mapped (and denoised) again with --from-hdr.
+    if (!writePFM(&fb, options.hdrOutputFileName))
+    {
+      std::cout << "There was a problem writing " << options.hdrOutputFileName << "\n";
+    }
+    if (options.denoise && !writeAuxBuffers(&aux, options.hdrOutputFileName))
+    {
+      std::cout << "There was a problem writing the albedo/normal/depth/variance files\n";
+    }
+  }
+
+  if (options.denoise)
+  {
+    denoise(&fb, &aux, options.denoiser);
+  }
+  freeAuxBuffers(&aux);
+
+  uint8 *ldrPixels = new uint8[3*pixelCount(fb.width, fb.height)];
+  tonemap(&fb, options.tonemap, ldrPixels);
+
+  // Create a .ppm file
+  writePPM(ldrPixels, fb.width, fb.height, options.imageFileName);
+
+  delete[] ldrPixels;
+  freeFramebuffer(&fb);
+
+  if (options.headless)
+  {
+    return(0);
+  }
+
+  // NOTE(ralntdir): The interactive mode has shown the image already.
+  if (options.interactive && !options.hdrInputFileName)
+  {
+    IMG_Quit();
+    SDL_Quit();
+
+    return(0);
+  }
 
   // Load the image
-  surface = IMG_Load("image.ppm");
+  surface = IMG_Load(options.imageFileName);
   if (surface == 0)
   {
     std::cout << "Error in IMG_Load(): " << IMG_GetError() << "\n";